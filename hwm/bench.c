@@ -0,0 +1,480 @@
+/*
+ * Copyright (c) 2024
+ * Hans Toshihide Törnqvist <hans.tornqvist@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Load generator for hwm, see 'make bench'. Assumes hwm runs with the
+ * default config on an otherwise empty display, and talks to it only
+ * through the X server like any other client would. Key and pointer
+ * input is faked with XTEST.
+ */
+
+#include <sys/time.h>
+#include <X11/keysym.h>
+#include <err.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <xcb/xcb.h>
+#include <xcb/xcb_keysyms.h>
+#include <xcb/xtest.h>
+
+#define FUNC_RETURNS __attribute__ ((warn_unused_result))
+
+#define CALLOC(ptr, num) do {\
+		ptr = calloc(num, sizeof *ptr); \
+		if (!ptr) { \
+			err(EXIT_FAILURE, "%s:%d: calloc(%d,%d)", \
+			    __FILE__, __LINE__, (int)num, (int)sizeof *ptr); \
+		} \
+	} while (0)
+#define HIDDEN_X 10000
+#define LENGTH(arr) (sizeof arr / sizeof *arr)
+#define MAX(a, b) (a > b ? a : b)
+#define TIMEOUT 2000.0
+
+struct Win {
+	xcb_window_t	id;
+	int	x, y;
+	int	is_mapped;
+	int	configure_num;
+	double	t_configure;
+};
+
+static int			configure_sum(void) FUNC_RETURNS;
+static void			fake_button(int, int);
+static void			fake_key(xcb_keycode_t, int);
+static void			fake_motion(int, int);
+static xcb_keycode_t		keycode_get(xcb_keysym_t) FUNC_RETURNS;
+static void			phase_drag(void);
+static void			phase_map(void);
+static void			phase_title(void);
+static void			phase_unmap(void);
+static void			phase_urgency(void);
+static void			phase_workspace(void);
+static int			pump(double);
+static double			sentinel(void);
+static double			time_get(void) FUNC_RETURNS;
+static struct Win		*win_find(xcb_window_t) FUNC_RETURNS;
+static int			win_hidden_num(void) FUNC_RETURNS;
+static void			win_map(struct Win *);
+
+static xcb_connection_t *g_conn;
+static xcb_screen_t *g_screen;
+static xcb_key_symbols_t *g_key_symbols;
+static xcb_atom_t g_net_wm_name;
+static xcb_atom_t g_utf8_string;
+static struct Win *g_win;
+static int g_win_num;
+static int g_iter_num;
+static unsigned long g_event_num;
+
+int
+configure_sum()
+{
+	int i, sum;
+
+	sum = 0;
+	for (i = 0; g_win_num > i; ++i) {
+		sum += g_win[i].configure_num;
+	}
+	return sum;
+}
+
+void
+fake_button(int a_button, int a_is_press)
+{
+	xcb_test_fake_input(g_conn, a_is_press ? XCB_BUTTON_PRESS :
+	    XCB_BUTTON_RELEASE, a_button, XCB_CURRENT_TIME, XCB_NONE, 0, 0,
+	    0);
+}
+
+void
+fake_key(xcb_keycode_t a_keycode, int a_is_press)
+{
+	xcb_test_fake_input(g_conn, a_is_press ? XCB_KEY_PRESS :
+	    XCB_KEY_RELEASE, a_keycode, XCB_CURRENT_TIME, XCB_NONE, 0, 0, 0);
+}
+
+void
+fake_motion(int a_x, int a_y)
+{
+	xcb_test_fake_input(g_conn, XCB_MOTION_NOTIFY, 0, XCB_CURRENT_TIME,
+	    g_screen->root, a_x, a_y, 0);
+}
+
+xcb_keycode_t
+keycode_get(xcb_keysym_t a_keysym)
+{
+	xcb_keycode_t *keycodes, keycode;
+
+	keycodes = xcb_key_symbols_get_keycode(g_key_symbols, a_keysym);
+	if (!keycodes || XCB_NO_SYMBOL == keycodes[0]) {
+		errx(EXIT_FAILURE, "No keycode for keysym 0x%x.",
+		    (unsigned)a_keysym);
+	}
+	keycode = keycodes[0];
+	free(keycodes);
+	return keycode;
+}
+
+/*
+ * Grabs the first window with Super+button1 and shakes it about, it may be
+ * covered so count configures on any window.
+ */
+void
+phase_drag()
+{
+	struct Win const *w = &g_win[0];
+	xcb_keycode_t super;
+	double t0, t1;
+	int configure_num, i, x, y;
+
+	super = keycode_get(XK_Super_L);
+	x = w->x + 20;
+	y = w->y + 20;
+	fake_motion(x, y);
+	fake_key(super, 1);
+	fake_button(1, 1);
+	xcb_flush(g_conn);
+	while (pump(50.0))
+		;
+	configure_num = configure_sum();
+	t0 = time_get();
+	for (i = 0; g_iter_num > i; ++i) {
+		fake_motion(x + i % 200, y + (i / 2) % 100);
+		if (0 == i % 16) {
+			xcb_flush(g_conn);
+			while (pump(0.0))
+				;
+		}
+	}
+	fake_button(1, 0);
+	fake_key(super, 0);
+	xcb_flush(g_conn);
+	t1 = sentinel();
+	printf("drag: %d motions, %d configures in %.2f ms\n", g_iter_num,
+	    configure_sum() - configure_num, t1 - t0);
+}
+
+void
+phase_map()
+{
+	double sum, max;
+	int i;
+
+	sum = max = 0.0;
+	for (i = 0; g_win_num > i; ++i) {
+		struct Win *w = &g_win[i];
+		uint32_t values[1];
+		double t0, dt;
+
+		w->id = xcb_generate_id(g_conn);
+		values[0] = XCB_EVENT_MASK_STRUCTURE_NOTIFY;
+		xcb_create_window(g_conn, XCB_COPY_FROM_PARENT, w->id,
+		    g_screen->root, 0, 0, 50 + (i * 37) % 400,
+		    40 + (i * 53) % 300, 0, XCB_WINDOW_CLASS_INPUT_OUTPUT,
+		    g_screen->root_visual, XCB_CW_EVENT_MASK, values);
+		t0 = time_get();
+		win_map(w);
+		dt = w->t_configure - t0;
+		sum += dt;
+		max = MAX(dt, max);
+	}
+	printf("map: %d windows, avg %.3f ms, max %.3f ms\n", g_win_num,
+	    sum / g_win_num, max);
+}
+
+void
+phase_title()
+{
+	double t0, t1;
+	int i;
+
+	t0 = time_get();
+	for (i = 0; g_iter_num > i; ++i) {
+		char title[64];
+		int len;
+
+		len = sprintf(title, "bench title %d", i);
+		xcb_change_property(g_conn, XCB_PROP_MODE_REPLACE,
+		    g_win[i % g_win_num].id, g_net_wm_name, g_utf8_string, 8,
+		    len, title);
+	}
+	t1 = sentinel();
+	printf("title: %d changes in %.2f ms\n", g_iter_num, t1 - t0);
+}
+
+void
+phase_unmap()
+{
+	double t0, t1;
+	int i;
+
+	t0 = time_get();
+	for (i = 0; g_win_num > i; ++i) {
+		xcb_destroy_window(g_conn, g_win[i].id);
+	}
+	t1 = sentinel();
+	printf("unmap: %d windows in %.2f ms\n", g_win_num, t1 - t0);
+}
+
+void
+phase_urgency()
+{
+	double t0, t1;
+	int i;
+
+	t0 = time_get();
+	for (i = 0; g_iter_num > i; ++i) {
+		uint32_t hints[9];
+
+		memset(hints, 0, sizeof hints);
+		/* Toggle XUrgencyHint. */
+		hints[0] = (i / g_win_num) & 1 ? 0 : 1 << 8;
+		xcb_change_property(g_conn, XCB_PROP_MODE_REPLACE,
+		    g_win[i % g_win_num].id, XCB_ATOM_WM_HINTS,
+		    XCB_ATOM_WM_HINTS, 32, LENGTH(hints), hints);
+	}
+	t1 = sentinel();
+	printf("urgency: %d flips in %.2f ms\n", g_iter_num, t1 - t0);
+}
+
+/* Switches away and back, waiting for every window to follow. */
+void
+phase_workspace()
+{
+	xcb_keycode_t super, ws[2];
+	double t0, dt[2];
+	int i;
+
+	super = keycode_get(XK_Super_L);
+	ws[0] = keycode_get(XK_f);
+	ws[1] = keycode_get(XK_w);
+	for (i = 0; 2 > i; ++i) {
+		int const c_target = 0 == i ? g_win_num : 0;
+
+		t0 = time_get();
+		fake_key(super, 1);
+		fake_key(ws[i], 1);
+		fake_key(ws[i], 0);
+		fake_key(super, 0);
+		xcb_flush(g_conn);
+		while (c_target != win_hidden_num()) {
+			if (!pump(TIMEOUT)) {
+				errx(EXIT_FAILURE, "Workspace switch timed "
+				    "out, is hwm running with the default "
+				    "config?");
+			}
+		}
+		dt[i] = time_get() - t0;
+	}
+	printf("workspace: away %.3f ms, back %.3f ms\n", dt[0], dt[1]);
+}
+
+/* Returns 1 if an event was handled before the timeout. */
+int
+pump(double a_timeout)
+{
+	xcb_generic_event_t *event;
+	struct Win *w;
+
+	xcb_flush(g_conn);
+	if (!(event = xcb_poll_for_event(g_conn))) {
+		struct pollfd fds;
+
+		fds.fd = xcb_get_file_descriptor(g_conn);
+		fds.events = POLLIN;
+		if (0 >= poll(&fds, 1, (int)a_timeout)) {
+			return 0;
+		}
+		if (!(event = xcb_poll_for_event(g_conn))) {
+			if (xcb_connection_has_error(g_conn)) {
+				errx(EXIT_FAILURE, "Lost X connection.");
+			}
+			return 0;
+		}
+	}
+	++g_event_num;
+	switch (event->response_type & ~0x80) {
+	case XCB_CONFIGURE_NOTIFY:
+		{
+			xcb_configure_notify_event_t const *e =
+			    (void *)event;
+
+			if ((w = win_find(e->window))) {
+				w->x = e->x;
+				w->y = e->y;
+				++w->configure_num;
+				w->t_configure = time_get();
+			}
+		}
+		break;
+	case XCB_MAP_NOTIFY:
+		{
+			xcb_map_notify_event_t const *e = (void *)event;
+
+			if ((w = win_find(e->window))) {
+				w->is_mapped = 1;
+			}
+		}
+		break;
+	case XCB_UNMAP_NOTIFY:
+		{
+			xcb_unmap_notify_event_t const *e = (void *)event;
+
+			if ((w = win_find(e->window))) {
+				w->is_mapped = 0;
+			}
+		}
+		break;
+	}
+	free(event);
+	return 1;
+}
+
+/*
+ * hwm handles events in order, so once a fresh window has been placed,
+ * everything sent before it has been handled too.
+ */
+double
+sentinel()
+{
+	struct Win *w = &g_win[g_win_num];
+	uint32_t values[1];
+	double t;
+
+	memset(w, 0, sizeof *w);
+	w->id = xcb_generate_id(g_conn);
+	values[0] = XCB_EVENT_MASK_STRUCTURE_NOTIFY;
+	xcb_create_window(g_conn, XCB_COPY_FROM_PARENT, w->id, g_screen->root,
+	    0, 0, 10, 10, 0, XCB_WINDOW_CLASS_INPUT_OUTPUT,
+	    g_screen->root_visual, XCB_CW_EVENT_MASK, values);
+	win_map(w);
+	t = w->t_configure;
+	xcb_destroy_window(g_conn, w->id);
+	xcb_flush(g_conn);
+	w->id = XCB_NONE;
+	return t;
+}
+
+double
+time_get()
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec * 1e3 + tv.tv_usec * 1e-3;
+}
+
+struct Win *
+win_find(xcb_window_t a_window)
+{
+	int i;
+
+	/* The sentinel lives past the end. */
+	for (i = 0; g_win_num >= i; ++i) {
+		if (a_window == g_win[i].id) {
+			return &g_win[i];
+		}
+	}
+	return NULL;
+}
+
+int
+win_hidden_num()
+{
+	int i, num;
+
+	num = 0;
+	for (i = 0; g_win_num > i; ++i) {
+		num += HIDDEN_X == g_win[i].x;
+	}
+	return num;
+}
+
+/* Maps and waits until hwm has mapped and placed the window. */
+void
+win_map(struct Win *a_win)
+{
+	double t0;
+	int configure_num;
+
+	configure_num = a_win->configure_num;
+	xcb_map_window(g_conn, a_win->id);
+	t0 = time_get();
+	while (!a_win->is_mapped || configure_num == a_win->configure_num) {
+		if (!pump(TIMEOUT) || TIMEOUT < time_get() - t0) {
+			errx(EXIT_FAILURE, "Map timed out, is hwm running?");
+		}
+	}
+}
+
+int
+main(int argc, char **argv)
+{
+	char const *c_names[] = {"_NET_WM_NAME", "UTF8_STRING"};
+	xcb_intern_atom_cookie_t cookie[LENGTH(c_names)];
+	xcb_intern_atom_reply_t *reply;
+	double t0, t1;
+	size_t i;
+
+	g_win_num = argc > 1 ? atoi(argv[1]) : 100;
+	g_iter_num = argc > 2 ? atoi(argv[2]) : 1000;
+	if (0 >= g_win_num || 0 >= g_iter_num) {
+		fprintf(stderr, "Usage: %s [windows [iterations]]\n", argv[0]);
+		exit(EXIT_FAILURE);
+	}
+
+	g_conn = xcb_connect(NULL, NULL);
+	if (xcb_connection_has_error(g_conn)) {
+		errx(EXIT_FAILURE, "Could not connect to X server.");
+	}
+	g_screen = xcb_setup_roots_iterator(xcb_get_setup(g_conn)).data;
+	if (!xcb_get_extension_data(g_conn, &xcb_test_id)->present) {
+		errx(EXIT_FAILURE, "XTEST missing.");
+	}
+	g_key_symbols = xcb_key_symbols_alloc(g_conn);
+	for (i = 0; LENGTH(c_names) > i; ++i) {
+		cookie[i] = xcb_intern_atom(g_conn, 0, strlen(c_names[i]),
+		    c_names[i]);
+	}
+	reply = xcb_intern_atom_reply(g_conn, cookie[0], NULL);
+	g_net_wm_name = reply->atom;
+	free(reply);
+	reply = xcb_intern_atom_reply(g_conn, cookie[1], NULL);
+	g_utf8_string = reply->atom;
+	free(reply);
+
+	CALLOC(g_win, g_win_num + 1);
+
+	t0 = time_get();
+	phase_map();
+	phase_title();
+	phase_urgency();
+	phase_workspace();
+	phase_drag();
+	phase_unmap();
+	t1 = time_get();
+	printf("total: %.2f ms, %lu events received\n", t1 - t0,
+	    g_event_num);
+
+	free(g_win);
+	xcb_key_symbols_free(g_key_symbols);
+	xcb_disconnect(g_conn);
+	return 0;
+}
@@ -0,0 +1,35 @@
+#!/bin/sh
+# Runs hwm on a private Xvfb and loads it with hwm_bench, see README.
+
+set -e
+
+display=${BENCH_DISPLAY:-:77}
+windows=${BENCH_WINDOWS:-100}
+iterations=${BENCH_ITERATIONS:-1000}
+log=bench_hwm.log
+
+Xvfb $display -screen 0 1920x1080x24 -nolisten tcp >/dev/null 2>&1 &
+xvfb_pid=$!
+trap 'kill $hwm_pid $xvfb_pid 2>/dev/null' EXIT
+sleep 1
+DISPLAY=$display ./hwm 2>$log &
+hwm_pid=$!
+sleep 1
+
+DISPLAY=$display ./hwm_bench $windows $iterations | tee bench.out
+
+kill -USR1 $hwm_pid
+sleep 1
+stats=$(grep 'hwm: batches=' $log | tail -n 1)
+echo "$stats"
+ms=$(awk '/^total:/ {print $2}' bench.out)
+echo "$stats" | tr -d . | awk -v ms=$ms -F'[ =]' \
+    '{printf "rate: %.0f events/s\n", $5 * 1000 / ms}'
+rm -f bench.out
+if test -r /proc/$hwm_pid/stat; then
+	# Fields 14 and 15 are utime and stime in clock ticks.
+	awk -v hz=$(getconf CLK_TCK) \
+	    '{printf "cpu: %.3f s\n", ($14 + $15) / hz}' /proc/$hwm_pid/stat
+else
+	echo "cpu: $(ps -o time= -p $hwm_pid)"
+fi
@@ -0,0 +1,133 @@
+/*
+ * Copyright (c) 2024
+ * Hans Toshihide Törnqvist <hans.tornqvist@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Times string_convert() against the iconv path it replaced on long browser
+ * titles, see 'make bench-string'. hwm.c is included to get at the static
+ * function, its main is renamed away.
+ */
+
+int	hwm_main(int, char **);
+
+#define main hwm_main
+#include "hwm.c"
+#undef main
+
+#include <iconv.h>
+
+static void	iconv_convert(struct String *, char const *, size_t);
+
+static iconv_t g_iconv;
+
+static char const *c_title[] = {
+	"How to write a fast UTF-8 decoder without branches in C - Stack "
+	    "Overflow - Mozilla Firefox",
+	"GitHub - torvalds/linux: Linux kernel source tree, pull requests "
+	    "and issues - Chromium",
+	"R\xc3\xa9sum\xc3\xa9 \xe2\x80\x93 Caf\xc3\xa9 na\xc3\xafve "
+	    "fa\xc3\xa7" "ade \xe2\x80\x94 Notes (draft) \xe2\x80\x94 "
+	    "Mozilla Firefox",
+	"\xe6\x97\xa5\xe6\x9c\xac\xe8\xaa\x9e\xe3\x81\xae\xe3\x82\xa6"
+	    "\xe3\x82\xa3\xe3\x83\xb3\xe3\x83\x89\xe3\x82\xa6\xe3\x82\xbf"
+	    "\xe3\x82\xa4\xe3\x83\x88\xe3\x83\xab - YouTube - Chromium",
+	"\xd0\x9d\xd0\xbe\xd0\xb2\xd0\xbe\xd1\x81\xd1\x82\xd0\xb8 "
+	    "\xd0\xb4\xd0\xbd\xd1\x8f: \xd0\xbf\xd0\xbe\xd0\xb3\xd0\xbe"
+	    "\xd0\xb4\xd0\xb0 \xd0\xb8 \xd1\x81\xd0\xbf\xd0\xbe\xd1\x80"
+	    "\xd1\x82 - Mozilla Firefox"
+};
+
+void
+iconv_convert(struct String *a_out, char const *a_in, size_t a_inlen)
+{
+	char *p = (char *)a_out->str;
+	size_t i, inlen = a_inlen;
+	size_t len;
+
+	len = sizeof a_out->str;
+	iconv(g_iconv, (char **)&a_in, &inlen, &p, &len);
+	a_out->length = (sizeof a_out->str - len) / 2;
+
+	a_out->width = 0;
+	for (i = 0; a_out->length > i; ++i) {
+		int width;
+
+		if (0 > (width = glyph_width(a_out->str[i].byte1,
+		    a_out->str[i].byte2))) {
+			width = 0;
+		}
+		a_out->width += width;
+	}
+}
+
+int
+main(int argc, char **argv)
+{
+	struct String s1, s2;
+	double t0, t_iconv, t_table;
+	size_t len[LENGTH(c_title)], bytes, i, j, iter_num;
+
+	iter_num = argc > 1 ? strtol(argv[1], NULL, 10) : 1000000;
+	if (0 >= (long)iter_num) {
+		fprintf(stderr, "Usage: %s [iterations]\n", argv[0]);
+		exit(EXIT_FAILURE);
+	}
+	if ((iconv_t)-1 == (g_iconv = iconv_open("UCS-2BE", "UTF-8"))) {
+		err(EXIT_FAILURE, "Could not open iconv(UCS-2BE, UTF-8).");
+	}
+	/* No font, every glyph comes out zero wide. */
+	CALLOC(g_font_info, 1);
+
+	bytes = 0;
+	for (i = 0; LENGTH(c_title) > i; ++i) {
+		len[i] = strlen(c_title[i]);
+		bytes += len[i];
+		string_convert(&s1, c_title[i], len[i]);
+		iconv_convert(&s2, c_title[i], len[i]);
+		if (s1.length != s2.length || 0 != memcmp(s1.str, s2.str,
+		    s1.length * sizeof *s1.str)) {
+			errx(EXIT_FAILURE, "Title %d differs.", (int)i);
+		}
+	}
+
+	t0 = time_get();
+	for (j = 0; iter_num > j; ++j) {
+		for (i = 0; LENGTH(c_title) > i; ++i) {
+			iconv_convert(&s2, c_title[i], len[i]);
+		}
+	}
+	t_iconv = time_get() - t0;
+
+	t0 = time_get();
+	for (j = 0; iter_num > j; ++j) {
+		for (i = 0; LENGTH(c_title) > i; ++i) {
+			string_convert(&s1, c_title[i], len[i]);
+		}
+	}
+	t_table = time_get() - t0;
+
+	printf("%d titles x %lu, %d bytes each on average:\n",
+	    (int)LENGTH(c_title), (unsigned long)iter_num,
+	    (int)(bytes / LENGTH(c_title)));
+	printf("iconv  %7.1f ns/title\n", 1e6 * t_iconv / iter_num /
+	    LENGTH(c_title));
+	printf("table  %7.1f ns/title (%.1fx)\n", 1e6 * t_table / iter_num /
+	    LENGTH(c_title), t_iconv / t_table);
+
+	iconv_close(g_iconv);
+	free(g_font_info);
+	return 0;
+}
@@ -19,11 +19,16 @@ static char const	c_bar_bg[] = "black";
 static char const	c_bar_fg[] = "white";
 static char const	c_border_focus[] = "red";
 static char const	c_border_unfocus[] = "blue";
+static int const	c_drag_rate = 0;
 static char const	c_font_face[] = "fixed";
-static char const	c_persist_file[] = "/tmp/hwm.txt";
+static char const	c_persist_file[] = "/tmp/hwm.state";
+static int const	c_randr_delay = 100;
 static int const	c_snap_margin = 6;
+static char const	c_stats_file[] = "/tmp/hwm.stats";
+static int const	c_status_battery_min = 5;
+static char const	c_status_clock_format[] = "%a %Y-%m-%d %H:%M";
 static int const	c_text_padding = 4;
-static int const	c_timeout_normal = 3000;
+static int const	c_title_rate = 10;
 static int const	c_timeout_blink = 200;
 static char const	c_urgent1_bg[] = "red";
 static char const	c_urgent1_fg[] = "white";
@@ -68,6 +73,13 @@ static struct KeyBind const c_key_bind[] = {
 	{XK_a, MOD_MASK1, action_exec, {0, c_app_term}},
 	{XK_g, MOD_MASK1, action_exec, {0, c_app_dmenu}}
 };
+/* Status modules right of the root name, refresh period in ms. */
+static struct StatusBind const c_status_bind[] = {
+	{status_load, 5000},
+	{status_memory, 5000},
+	{status_battery, 30000},
+	{status_clock, 60000}
+};
 static struct ButtonBind const c_button_bind[] = {
 	{CLICK_WORKSPACE, 1, 0, action_workspace_select},
 	{CLICK_CLIENT, 1, MOD_MASK1, action_client_move},
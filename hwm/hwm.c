@@ -22,16 +22,28 @@
  * Really keep mouse warping for alt-tab?
  */
 
+/* For clock_gettime, pread and snprintf. */
+#define _POSIX_C_SOURCE 200809L
+#if defined(__linux__)
+/* For memfd_create. */
+#define _GNU_SOURCE
+#endif
+
+#include <sys/mman.h>
 #include <sys/queue.h>
-#include <sys/time.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
 #include <assert.h>
+#include <dirent.h>
 #include <err.h>
-#include <iconv.h>
+#include <fcntl.h>
+#include <limits.h>
 #include <poll.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 #include <xcb/randr.h>
 #include <xcb/xcb_event.h>
@@ -56,10 +68,12 @@
 		x = NULL; \
 	} while (0)
 #define HEIGHT_B(c) (c->height + 2 * c->border_width)
+#define HISTOGRAM_NUM 24
 #define HWM_XCB_CHECKED(msg, func, args) do { \
 		xcb_void_cookie_t cookie_; \
 		xcb_generic_error_t *error_; \
 		cookie_ = func args; \
+		audit_count(__LINE__); \
 		if (NULL != (error_ = xcb_request_check(g_conn, cookie_))) { \
 			fprintf(stderr, msg" (%u,%u,0x%08x,%d,%d).\n", \
 			    error_->response_type, error_->error_code, \
@@ -72,6 +86,17 @@
 #define LENGTH(x) (sizeof x / sizeof *x)
 #define MAX(a, b) (a > b ? a : b)
 #define MIN(a, b) (a < b ? a : b)
+#define REALLOC(ptr, num) do {\
+		void *p_; \
+		p_ = realloc(ptr, (num) * sizeof *ptr); \
+		if (!p_) { \
+			err(EXIT_FAILURE, "%s:%d: realloc(%d,%d)", \
+			    __FILE__, __LINE__, (int)(num), (int)sizeof *ptr); \
+		} \
+		ptr = p_; \
+	} while (0)
+#define REPLY(reply) reply_get(reply, __LINE__)
+#define REPLY_PROPERTY(cookie) property_reply(cookie, __LINE__)
 #define SNAP(op, ref, test, margin) \
 	test = ref op test && test op margin ? ref : test
 #define VIEW_BOTTOM(v) (v->y + v->height)
@@ -82,9 +107,15 @@
 #define ZERO(x) memset(&x, 0, sizeof x)
 
 enum Click { CLICK_ROOT, CLICK_WORKSPACE, CLICK_STATUS, CLICK_CLIENT };
+enum EdgeType { EDGE_LEFT, EDGE_RIGHT, EDGE_TOP, EDGE_BOTTOM, EDGE_NUM };
 enum JumpDirection { DIR_EAST, DIR_NORTH, DIR_WEST, DIR_SOUTH };
 enum Maximize { MAX_NOPE, MAX_BOTH, MAX_VERT };
+enum Probe { PROBE_BAR_DRAW, PROBE_CLIENT_PLACE, PROBE_MOVE, PROBE_RESIZE,
+	PROBE_BROWSE, PROBE_NUM };
 enum RunControl { RUN_LOOP, RUN_QUIT, RUN_RESTART };
+enum Scheme { SCHEME_NORMAL, SCHEME_FOCUS, SCHEME_URGENT1, SCHEME_URGENT2,
+	SCHEME_NUM };
+enum TraceType { TRACE_EVENT, TRACE_NONE, TRACE_REPLY };
 enum Visibility { VISIBLE, HIDDEN };
 
 struct Arg {
@@ -93,29 +124,169 @@ struct Arg {
 };
 struct String {
 	size_t	length;
-	char	str[80];
+	int	width;
+	xcb_char2b_t	str[40];
 };
 TAILQ_HEAD(ViewList, View);
 struct View {
 	xcb_randr_output_t	output;
 	int	x, y;
 	int	width, height;
+	int	rate;
+	/* The bar on this output and its last drawn segments. */
+	xcb_window_t	bar;
+	xcb_pixmap_t	pixmap;
+	int	is_bar_reset;
+	int	status_width;
+	struct	Segment *segment, *segment_next;
+	size_t	segment_num, segment_cap;
 	TAILQ_ENTRY(View)	next;
 };
 TAILQ_HEAD(ClientList, Client);
+/* Server side state of a client, as last sent and as wanted at commit. */
+struct Shadow {
+	int	x, y;
+	int	width, height;
+	int	border_width;
+	uint32_t	border_color;
+};
 struct Client {
 	xcb_window_t	window;
+	struct	Shadow sent, want;
+	int	is_pending;
 	xcb_size_hints_t	hints;
+	xcb_icccm_wm_hints_t	wm_hints;
 	int	is_urgent;
 	struct	String name;
+	int	is_name_dirty;
+	double	name_time;
 	int	x, y;
 	int	width, height;
 	int	border_width;
 	enum	Maximize maximize;
 	int	max_old_x, max_old_y;
 	int	max_old_width, max_old_height;
+	int	edge[EDGE_NUM];
 	TAILQ_ENTRY(Client)	next;
 };
+struct Edge {
+	int	value;
+	struct	Client *client;
+};
+struct EdgeIndex {
+	struct	Edge *edge[EDGE_NUM];
+	size_t	num, cap;
+};
+struct NameCookie {
+	xcb_get_property_cookie_t	net_wm_name;
+	xcb_get_property_cookie_t	wm_name;
+};
+struct Adopt {
+	xcb_window_t	window;
+	xcb_window_t	parent;
+	int	data[10];
+	struct	Client *client;
+	xcb_get_window_attributes_cookie_t	attr;
+	xcb_get_geometry_cookie_t	geom;
+	xcb_get_property_cookie_t	hints;
+	xcb_get_property_cookie_t	wm_hints;
+	struct	NameCookie name;
+};
+struct Segment {
+	struct	String const *text;
+	int	x, width;
+	enum	Scheme scheme;
+	int	has_mark;
+	uint32_t	hash;
+};
+struct Span {
+	int	x0, x1;
+};
+struct Skyline {
+	int	x, y;
+	int	width;
+};
+struct PlaceCell {
+	double	a, b, s;
+	double	cov;
+};
+struct Place {
+	int	width_b, height_b;
+	int	*xs, *ys;
+	int	*tx, *ty;
+	size_t	*tx_cell0, *tx_cell1;
+	int	*delta;
+	struct	PlaceCell *cell;
+	size_t	mx, my;
+	size_t	tx_num, ty_num;
+};
+struct ClientSlot {
+	xcb_window_t	window;
+	struct	Client *client;
+	size_t	workspace;
+};
+/* Bucket i counts durations of [2^i,2^(i+1)) us, the first also 0. */
+struct Histogram {
+	unsigned long	bucket[HISTOGRAM_NUM];
+	unsigned long	num;
+	double	sum;
+};
+struct TraceHeader {
+	char	magic[8];
+	uint32_t	version;
+	uint32_t	resource_id_base;
+	uint8_t	randr_evbase;
+	uint8_t	pad[3];
+};
+struct TraceRecord {
+	uint8_t	type;
+	uint8_t	pad[3];
+	uint32_t	time;
+	uint32_t	size;
+};
+struct PersistHeader {
+	char	magic[8];
+	uint32_t	version;
+	uint32_t	workspace;
+	uint32_t	focus;
+	uint32_t	num;
+};
+/* Data as in struct Adopt. */
+struct PersistClient {
+	uint32_t	window;
+	int32_t	data[10];
+};
+struct Status {
+	char	raw[80];
+	struct	String text;
+	int	is_urgent;
+	double	time;
+};
+struct Timer {
+	double	time;
+	void	(*func)(void);
+};
+struct ColorRequest {
+	char const	*name;
+	uint32_t	*pixel;
+	int	is_local;
+	xcb_alloc_named_color_cookie_t	cookie;
+};
+struct RandrCookie {
+	xcb_randr_get_screen_resources_current_cookie_t	res;
+	xcb_randr_get_output_primary_cookie_t	primary;
+};
+struct Audit {
+	void	(*action)(struct Arg const *);
+	char const	*name;
+	int	budget;
+	unsigned long	run_num, reply_num, reply_max;
+};
+struct AuditSite {
+	int	scope;
+	int	line;
+	unsigned long	num;
+};
 struct ButtonBind {
 	enum	Click click;
 	int	code;
@@ -128,6 +299,10 @@ struct KeyBind {
 	void	(*action)(struct Arg const *);
 	struct	Arg arg;
 };
+struct StatusBind {
+	void	(*func)(char *, size_t);
+	int	period;
+};
 
 static void			action_client_browse(struct Arg const *);
 static void			action_client_expand(struct Arg const *);
@@ -141,27 +316,57 @@ static void			action_exec(struct Arg const *);
 static void			action_furnish(struct Arg const *);
 static void			action_kill(struct Arg const *);
 static void			action_quit(struct Arg const *);
+static void			action_run(void (*)(struct Arg const *),
+    struct Arg const *);
 static void			action_workspace_select(struct Arg const *);
-static xcb_atom_t		atom_get(char const *) FUNC_RETURNS;
+static void			audit_count(int);
+static void			bar_blink(void);
+static void			bar_damage(int, int);
 static void			bar_draw(void);
-static void			bar_reset(void);
+static void			bar_draw_view(struct View *);
+static void			bar_reset(struct View *);
 static void			button_grab(struct Client *);
 static struct Client		*client_add(xcb_window_t, xcb_window_t)
 	FUNC_RETURNS;
-static struct Client		*client_add_details(xcb_window_t,
-    xcb_window_t, int const *) FUNC_RETURNS;
+static struct Client		*client_add_details(struct Adopt *)
+	FUNC_RETURNS;
+static void			client_adopt(struct Adopt *, size_t);
 static void			client_free(struct Client **);
 static void			client_focus(struct Client *, int, int, int);
 static struct Client		*client_get(xcb_window_t, size_t *)
 	FUNC_RETURNS;
 static void			client_move(struct Client *, enum Visibility);
-static void			client_name_update(struct Client *);
-static void			client_place(struct Client *);
+static void			client_name_flush(void);
+static void			client_name_reply(struct Client *,
+    struct NameCookie const *);
+static void			client_name_request(xcb_window_t,
+    struct NameCookie *);
+static void			client_place(struct Client *, size_t);
 static void			client_resize(struct Client *, int);
+static struct ClientSlot	*client_slot_find(xcb_window_t) FUNC_RETURNS;
+static size_t			client_slot_hash(xcb_window_t) FUNC_RETURNS;
+static void			client_slot_rehash(void);
+static void			client_slot_set(struct Client *, size_t);
 static void			client_snap_dimension(struct Client *);
 static void			client_snap_position(struct Client *);
-static uint32_t			color_get(char const *) FUNC_RETURNS;
+static uint32_t			color_channel(unsigned, uint32_t)
+	FUNC_RETURNS;
+static int			color_parse(char const *, uint32_t *)
+	FUNC_RETURNS;
+static void			color_reply(struct ColorRequest *);
+static void			color_request(struct ColorRequest *);
 static xcb_cursor_t		cursor_get(xcb_font_t, int) FUNC_RETURNS;
+static void			drag(xcb_cursor_t, void (*)(int, int), enum Probe);
+static void			edge_insert(struct Client *, size_t);
+static size_t			edge_lower(struct Edge const *, size_t, int)
+	FUNC_RETURNS;
+static int			edge_next(enum EdgeType, int, int,
+    struct Client const *, int *) FUNC_RETURNS;
+static void			edge_remove(struct Client const *, size_t);
+static void			edge_update(struct Client *);
+static void			drag_move(int, int);
+static void			drag_resize(int, int);
+static void			event_batch(void);
 static void			event_button_press(xcb_button_press_event_t
     const *);
 static void			event_configure_notify(
@@ -174,24 +379,97 @@ static void			event_enter_notify(xcb_enter_notify_event_t
     const *);
 static void			event_expose(xcb_expose_event_t const *);
 static void			event_handle(xcb_generic_event_t const *);
+static xcb_generic_event_t	*event_poll(void) FUNC_RETURNS;
+static xcb_generic_event_t	*event_wait(void) FUNC_RETURNS;
 static void			event_key_press(xcb_key_press_event_t const
     *);
+static void			event_map_notify(xcb_map_notify_event_t const
+    *);
 static void			event_map_request(xcb_map_request_event_t
     const *);
+static void			event_mapping_notify(
+    xcb_mapping_notify_event_t const *);
 static void			event_property_notify(
     xcb_property_notify_event_t const *);
 static void			event_unmap_notify(xcb_unmap_notify_event_t
     const *);
+static void			ewmh_client_add(xcb_window_t, size_t);
+static void			ewmh_client_remove(xcb_window_t);
+static void			ewmh_desktop_set(xcb_window_t, size_t);
+static void			ewmh_flush(void);
+static int			furnish_cmp(void const *, void const *)
+	FUNC_RETURNS;
+static int			glyph_width(unsigned, unsigned) FUNC_RETURNS;
+static int			hex_parse(char const *, size_t, unsigned *)
+	FUNC_RETURNS;
+static void			histogram_add(struct Histogram *, double);
+static void			histogram_print(FILE *, char const *,
+    struct Histogram const *);
+static int			int_cmp(void const *, void const *)
+	FUNC_RETURNS;
+static void			key_grab(xcb_get_modifier_mapping_cookie_t);
 static void			my_exit(void);
-static void			randr_update(void);
+static double			place_area(int, size_t, int, size_t, int,
+    size_t, size_t) FUNC_RETURNS;
+static void			place_build(struct Client const *, size_t);
+static size_t			place_cell(int const *, size_t, int)
+	FUNC_RETURNS;
+static double			place_integral(int, size_t, int, size_t)
+	FUNC_RETURNS;
+static size_t			place_unique(int *, size_t) FUNC_RETURNS;
+static size_t			persist_load(int, struct Adopt *,
+    xcb_window_t *, size_t, xcb_window_t *) FUNC_RETURNS;
+static void			persist_save(void);
+static int			persist_write(int) FUNC_RETURNS;
+static xcb_get_property_reply_t	*property_reply(xcb_get_property_cookie_t,
+    int) FUNC_RETURNS;
+static void			randr_flush(void);
+static void			randr_request(struct RandrCookie *);
+static void			randr_update(struct RandrCookie const *);
+static void			*reply_get(void *, int) FUNC_RETURNS;
+static void			restart(char **);
 static void			root_name_update(void);
+static char const		*scope_name(int, char *) FUNC_RETURNS;
 static void			string_convert(struct String *, char const *,
     size_t);
-static int			text_draw(struct String const *, int, int,
-    int, int);
+static enum Scheme		scheme_get(int, int) FUNC_RETURNS;
+static void			skyline_add(int, int, int);
+static int			skyline_fit(int, int, int, int *, int *)
+	FUNC_RETURNS;
+static void			stats_print(void);
+static void			stats_signal(int);
+static void			status_battery(char *, size_t);
+static void			status_clock(char *, size_t);
+static void			status_load(char *, size_t);
+static void			status_memory(char *, size_t);
+static int			status_read(int *, char const *, char *,
+    size_t) FUNC_RETURNS;
+static void			status_update(void);
+static int			text_draw(xcb_drawable_t, struct String const *,
+    enum Scheme, int, int);
 static int			text_width(struct String const *);
+static double			time_get(void) FUNC_RETURNS;
+static void			timer_add(double, void (*)(void));
+static void			timer_arm(void);
+static size_t			timer_find(void (*)(void)) FUNC_RETURNS;
+static void			timer_remove(void (*)(void));
+static void			timer_run(void);
+static void			timer_sift(size_t);
+static void			trace_done(void);
+static xcb_generic_event_t	*trace_event(void) FUNC_RETURNS;
+static void			trace_open(char const *, int);
+static void			trace_rebase(xcb_window_t *);
+static void			*trace_reply(void *) FUNC_RETURNS;
+static void			trace_write(enum TraceType, void const *,
+    size_t);
+static void			txn_commit(void);
+static void			txn_touch(struct Client *);
 static void			view_clear(void);
+static void			view_fallback(void);
 static struct View const	*view_find(int, int) FUNC_RETURNS;
+static struct View		*view_find_bar(xcb_window_t) FUNC_RETURNS;
+static void			view_free(struct View *);
+static xcb_visualtype_t const	*visual_get(void) FUNC_RETURNS;
 
 #include "config.h"
 
@@ -199,42 +477,109 @@ typedef void (*EventHandler)(xcb_generic_event_t const *);
 
 static struct String *g_workspace_label;
 static uint32_t g_values[3];
-static EventHandler g_event_handler[30];
+static EventHandler g_event_handler[XCB_MAPPING_NOTIFY + 1];
 static xcb_connection_t *g_conn;
 static xcb_screen_t *g_screen;
-static iconv_t g_iconv = (iconv_t)-1;
+static xcb_visualtype_t const *g_visual;
 static xcb_key_symbols_t *g_key_symbols;
+/* Index + 1 into c_key_bind by keycode and state without lock modifiers. */
+static uint8_t g_key_dispatch[256][256];
+static uint16_t g_key_lock_mask;
 static xcb_drawable_t g_root;
 static struct String g_root_name;
+static int g_has_root_name;
+static struct Status *g_status;
 static int g_is_root_urgent;
-static xcb_gc_t g_gc;
-static xcb_pixmap_t g_pixmap;
+static xcb_gc_t g_gc_fill[SCHEME_NUM], g_gc_text[SCHEME_NUM];
+static struct Span *g_span;
+static size_t g_span_num, g_span_cap;
 static xcb_font_t g_font;
+static xcb_query_font_reply_t *g_font_info;
 static int g_font_ascent, g_font_height;
 static xcb_atom_t g_WM_DELETE_WINDOW, g_WM_PROTOCOLS;
 static xcb_atom_t g_NET_WM_NAME;
+static xcb_atom_t g_NET_ACTIVE_WINDOW, g_NET_CLIENT_LIST;
+static xcb_atom_t g_NET_CURRENT_DESKTOP, g_NET_NUMBER_OF_DESKTOPS;
+static xcb_atom_t g_NET_SUPPORTED, g_NET_WM_DESKTOP;
+/* _NET_CLIENT_LIST in mapping order and what has been published. */
+static xcb_window_t *g_ewmh_client;
+static size_t g_ewmh_client_num, g_ewmh_client_cap, g_ewmh_client_sent;
+static int g_ewmh_do_replace = 1;
+static xcb_window_t g_ewmh_active = (xcb_window_t)-1;
+static size_t g_ewmh_desktop = (size_t)-1;
 static xcb_cursor_t g_cursor_normal, g_cursor_move, g_cursor_resize;
-static xcb_window_t g_bar = XCB_NONE;
-static int g_do_bar_redraw;
+static int g_do_bar_redraw, g_has_name_dirty;
+/* Touched clients, the window to raise, and the one known to be on top. */
+static xcb_window_t *g_txn_window;
+static size_t g_txn_num, g_txn_cap;
+static xcb_window_t g_txn_raise, g_txn_top;
 static uint32_t g_color_border_focus, g_color_border_unfocus;
 static uint32_t g_color_bar_bg, g_color_bar_fg;
 static uint32_t g_color_urgent1_bg, g_color_urgent1_fg;
 static uint32_t g_color_urgent2_bg, g_color_urgent2_fg;
 static struct ViewList g_view_list = TAILQ_HEAD_INITIALIZER(g_view_list);
 static struct ClientList *g_client_list;
+static struct EdgeIndex *g_edge_index;
+static struct ClientSlot *g_client_slot;
+static struct Place g_place;
+static struct Skyline *g_skyline, *g_skyline_tmp;
+static size_t g_skyline_num;
+static size_t g_client_slot_num, g_client_slot_used, g_client_slot_live;
 static size_t g_workspace_cur;
 static struct Client *g_focus;
 static enum RunControl g_run;
-static int g_has_urgent, g_timeout, g_blink;
-static double g_time_prev;
+static int g_has_urgent, g_blink;
+/* Min-heap on time, the earliest one is armed on the timerfd. */
+static struct Timer *g_timer;
+static size_t g_timer_num, g_timer_cap;
+static int g_timer_fd = -1;
 static xcb_window_t g_button_press_window;
 static int g_button_press_x, g_button_press_y;
+static int g_pointer_x, g_pointer_y;
+static int g_drag_dx, g_drag_dy;
 static uint8_t g_randr_evbase;
+static unsigned long g_stat_batch_num, g_stat_event_num;
+static unsigned long g_stat_coalesced_num;
+static double g_stat_startup;
+static volatile sig_atomic_t g_do_stats;
+static struct Histogram g_hist_event[128], g_hist_probe[PROBE_NUM];
+/* Declared round trip budgets, -1 for none, enforced with --audit. */
+static struct Audit g_audit[] = {
+	{action_client_browse, "browse", 0},
+	{action_client_expand, "expand", 0},
+	{action_client_grow, "grow", 0},
+	{action_client_jump, "jump", 0},
+	{action_client_maximize, "maximize", 0},
+	{action_client_move, "move", 0},
+	{action_client_relocate, "relocate", 0},
+	{action_client_resize, "resize", 0},
+	{action_exec, "exec", 0},
+	{action_furnish, "furnish", 0},
+	{action_kill, "kill", 1},
+	{action_quit, "quit", 0},
+	{action_workspace_select, "workspace_select", 0},
+	/* Actions only bound in a custom config.h end up here. */
+	{NULL, "other", -1}
+};
+static struct Audit *g_audit_cur;
+static int g_audit_event_type = -1;
+static unsigned long g_audit_event[LENGTH(g_hist_event)];
+static struct AuditSite *g_audit_site;
+static size_t g_audit_site_num, g_audit_site_cap;
+static int g_audit_is_strict;
+static FILE *g_trace;
+static int g_trace_is_replay;
+static struct TraceHeader g_trace_header;
+static struct TraceRecord g_trace_record;
+static int g_trace_has_record;
+static double g_trace_time0;
+static unsigned long g_trace_event_num, g_trace_diverged_num;
 
 void
 action_client_browse(struct Arg const *a_arg)
 {
 	struct Client *c, *prev;
+	double t0 = -1;
 	int do_browse;
 
 	(void)a_arg;
@@ -253,12 +598,18 @@ action_client_browse(struct Arg const *a_arg)
 		if (c != prev) {
 			client_focus(c, 0, 1, 1);
 			bar_draw();
+			txn_commit();
 			xcb_flush(g_conn);
 			prev = c;
+			if (0 <= t0) {
+				histogram_add(&g_hist_probe[PROBE_BROWSE],
+				    t0);
+			}
 		}
-		if (!(event = xcb_wait_for_event(g_conn))) {
+		if (!(event = event_wait())) {
 			continue;
 		}
+		t0 = time_get();
 		kp = (xcb_key_press_event_t const *)event;
 		keysym = xcb_key_symbols_get_keysym(g_key_symbols, kp->detail,
 		    0);
@@ -293,41 +644,33 @@ void
 action_client_expand(struct Arg const *a_arg)
 {
 	struct View const *view;
-	struct Client *c;
-	int new, test;
+	int edge, new;
 
 	if (!g_focus) {
 		return;
 	}
 	view = view_find(g_focus->x, g_focus->y);
 	switch (a_arg->i) {
-	case DIR_EAST: new = VIEW_RIGHT(view) - g_focus->x - 2; break;
+	case DIR_EAST:
+		new = VIEW_RIGHT(view) - g_focus->x - 2;
+		if (edge_next(EDGE_LEFT, g_focus->x + WIDTH_B(g_focus) + 2, 1,
+		    g_focus, &edge)) {
+			new = MIN(new, edge - g_focus->x - 2);
+		}
+		g_focus->width = new;
+		break;
 	case DIR_NORTH: return;
 	case DIR_WEST: return;
-	case DIR_SOUTH: new = VIEW_BOTTOM(view) - g_focus->y - 2; break;
-	default: abort();
-	}
-	TAILQ_FOREACH(c, &g_client_list[g_workspace_cur], next) {
-		if (g_focus == c) {
-			continue;
-		}
-		switch (a_arg->i) {
-		case DIR_EAST:
-			test = c->x - g_focus->x - 2;
-			CONVERGE(<, WIDTH_B(g_focus), test, new);
-			break;
-		case DIR_NORTH:
-			/* FALLTHROUGH */
-		case DIR_WEST:
-			break;
-		case DIR_SOUTH:
-			test = c->y - g_focus->y - 2;
-			CONVERGE(<, HEIGHT_B(g_focus), test, new);
-			break;
+	case DIR_SOUTH:
+		new = VIEW_BOTTOM(view) - g_focus->y - 2;
+		if (edge_next(EDGE_TOP, g_focus->y + HEIGHT_B(g_focus) + 2, 1,
+		    g_focus, &edge)) {
+			new = MIN(new, edge - g_focus->y - 2);
 		}
+		g_focus->height = new;
+		break;
+	default: abort();
 	}
-	(DIR_EAST == a_arg->i || DIR_WEST == a_arg->i) ? (g_focus->width =
-	    new) : (g_focus->height = new);
 	client_resize(g_focus, 0);
 }
 
@@ -357,45 +700,45 @@ void
 action_client_jump(struct Arg const *a_arg)
 {
 	struct View const *view;
-	struct Client *c;
-	int new, test;
+	int edge, new;
 
 	if (!g_focus) {
 		return;
 	}
 	view = view_find(g_focus->x, g_focus->y);
 	switch (a_arg->i) {
-	case DIR_EAST: new = VIEW_RIGHT(view) - WIDTH_B(g_focus); break;
-	case DIR_NORTH: new = g_font_height; break;
-	case DIR_WEST: new = 0; break;
-	case DIR_SOUTH: new = VIEW_BOTTOM(view) - HEIGHT_B(g_focus); break;
-	default: abort();
-	}
-	TAILQ_FOREACH(c, &g_client_list[g_workspace_cur], next) {
-		if (g_focus == c) {
-			continue;
+	case DIR_EAST:
+		new = VIEW_RIGHT(view) - WIDTH_B(g_focus);
+		if (edge_next(EDGE_LEFT, g_focus->x + WIDTH_B(g_focus), 1,
+		    g_focus, &edge)) {
+			new = MIN(new, edge - WIDTH_B(g_focus));
 		}
-		switch (a_arg->i) {
-		case DIR_EAST:
-			test = c->x - WIDTH_B(g_focus);
-			CONVERGE(<, g_focus->x, test, new);
-			break;
-		case DIR_NORTH:
-			test = c->y + HEIGHT_B(c);
-			CONVERGE(>, g_focus->y, test, new);
-			break;
-		case DIR_WEST:
-			test = c->x + WIDTH_B(c);
-			CONVERGE(>, g_focus->x, test, new);
-			break;
-		case DIR_SOUTH:
-			test = c->y - HEIGHT_B(g_focus);
-			CONVERGE(<, g_focus->y, test, new);
-			break;
+		g_focus->x = new;
+		break;
+	case DIR_NORTH:
+		new = g_font_height;
+		if (edge_next(EDGE_BOTTOM, g_focus->y, -1, g_focus, &edge)) {
+			new = MAX(new, edge);
+		}
+		g_focus->y = new;
+		break;
+	case DIR_WEST:
+		new = 0;
+		if (edge_next(EDGE_RIGHT, g_focus->x, -1, g_focus, &edge)) {
+			new = MAX(new, edge);
+		}
+		g_focus->x = new;
+		break;
+	case DIR_SOUTH:
+		new = VIEW_BOTTOM(view) - HEIGHT_B(g_focus);
+		if (edge_next(EDGE_TOP, g_focus->y + HEIGHT_B(g_focus), 1,
+		    g_focus, &edge)) {
+			new = MIN(new, edge - HEIGHT_B(g_focus));
 		}
+		g_focus->y = new;
+		break;
+	default: abort();
 	}
-	(DIR_EAST == a_arg->i || DIR_WEST == a_arg->i) ? (g_focus->x = new) :
-	    (g_focus->y = new);
 	client_move(g_focus, VISIBLE);
 	xcb_warp_pointer(g_conn, XCB_NONE, g_focus->window, 0, 0, 0, 0,
 	    g_focus->width / 2, g_focus->height / 2);
@@ -460,49 +803,13 @@ action_client_maximize(struct Arg const *a_arg)
 void
 action_client_move(struct Arg const *a_arg)
 {
-	xcb_generic_event_t *event;
-	int dx, dy, do_move;
-
 	(void)a_arg;
 	if (!g_focus) {
 		return;
 	}
-	dx = g_focus->x - g_button_press_x;
-	dy = g_focus->y - g_button_press_y;
-	xcb_grab_pointer(g_conn, 0, g_focus->window,
-	    XCB_EVENT_MASK_BUTTON_RELEASE | XCB_EVENT_MASK_POINTER_MOTION,
-	    XCB_GRAB_MODE_ASYNC, XCB_GRAB_MODE_ASYNC, XCB_NONE, g_cursor_move,
-	    XCB_CURRENT_TIME);
-	xcb_flush(g_conn);
-	for (do_move = 1; do_move;) {
-		xcb_motion_notify_event_t *motion;
-
-		if (!(event = xcb_wait_for_event(g_conn))) {
-			continue;
-		}
-		switch (XCB_EVENT_RESPONSE_TYPE(event)) {
-		case XCB_BUTTON_RELEASE:
-			do_move = 0;
-			break;
-		case XCB_MOTION_NOTIFY:
-			motion = (xcb_motion_notify_event_t *)event;
-			g_focus->x = motion->root_x + dx;
-			g_focus->y = motion->root_y + dy;
-			client_snap_position(g_focus);
-			client_move(g_focus, VISIBLE);
-			xcb_flush(g_conn);
-			break;
-		case XCB_EXPOSE:
-			/* FALLTHROUGH */
-		case XCB_MAP_REQUEST:
-			/* FALLTHROUGH */
-		case XCB_CONFIGURE_REQUEST:
-			event_handle(event);
-			break;
-	}
-		free(event);
-	}
-	xcb_ungrab_pointer(g_conn, XCB_CURRENT_TIME);
+	g_drag_dx = g_focus->x - g_button_press_x;
+	g_drag_dy = g_focus->y - g_button_press_y;
+	drag(g_cursor_move, drag_move, PROBE_MOVE);
 	xcb_set_input_focus(g_conn, XCB_INPUT_FOCUS_POINTER_ROOT,
 	    g_focus->window, XCB_CURRENT_TIME);
 }
@@ -516,6 +823,10 @@ action_client_relocate(struct Arg const *a_arg)
 	}
 	TAILQ_REMOVE(&g_client_list[g_workspace_cur], g_focus, next);
 	TAILQ_INSERT_HEAD(&g_client_list[a_arg->i], g_focus, next);
+	edge_remove(g_focus, g_workspace_cur);
+	edge_insert(g_focus, a_arg->i);
+	client_slot_set(g_focus, a_arg->i);
+	ewmh_desktop_set(g_focus->window, a_arg->i);
 	client_move(g_focus, HIDDEN);
 	client_focus(NULL, 1, 0, 0);
 }
@@ -523,49 +834,13 @@ action_client_relocate(struct Arg const *a_arg)
 void
 action_client_resize(struct Arg const *a_arg)
 {
-	xcb_generic_event_t *event;
-	int dx, dy, do_resize;
-
 	(void)a_arg;
 	if (!g_focus) {
 		return;
 	}
-	dx = g_focus->width - g_button_press_x;
-	dy = g_focus->height - g_button_press_y;
-	xcb_grab_pointer(g_conn, 0, g_focus->window,
-	    XCB_EVENT_MASK_BUTTON_RELEASE | XCB_EVENT_MASK_POINTER_MOTION,
-	    XCB_GRAB_MODE_ASYNC, XCB_GRAB_MODE_ASYNC, XCB_NONE,
-	    g_cursor_resize, XCB_CURRENT_TIME);
-	xcb_flush(g_conn);
-	for (do_resize = 1; do_resize;) {
-		xcb_motion_notify_event_t *motion;
-
-		if (!(event = xcb_wait_for_event(g_conn))) {
-			continue;
-		}
-		switch (XCB_EVENT_RESPONSE_TYPE(event)) {
-		case XCB_BUTTON_RELEASE:
-			do_resize = 0;
-			break;
-		case XCB_MOTION_NOTIFY:
-			motion = (xcb_motion_notify_event_t *)event;
-			g_focus->width = motion->root_x + dx;
-			g_focus->height = motion->root_y + dy;
-			client_snap_dimension(g_focus);
-			client_resize(g_focus, 1);
-			xcb_flush(g_conn);
-			break;
-		case XCB_EXPOSE:
-			/* FALLTHROUGH */
-		case XCB_MAP_REQUEST:
-			/* FALLTHROUGH */
-		case XCB_CONFIGURE_REQUEST:
-			event_handle(event);
-			break;
-		}
-		free(event);
-	}
-	xcb_ungrab_pointer(g_conn, XCB_CURRENT_TIME);
+	g_drag_dx = g_focus->width - g_button_press_x;
+	g_drag_dy = g_focus->height - g_button_press_y;
+	drag(g_cursor_resize, drag_resize, PROBE_RESIZE);
 	xcb_set_input_focus(g_conn, XCB_INPUT_FOCUS_PARENT, g_focus->window,
 	    XCB_CURRENT_TIME);
 }
@@ -576,6 +851,9 @@ action_exec(struct Arg const *a_arg)
 	pid_t pid;
 	char const *arg0 = ((char const **)a_arg->v)[0];
 
+	if (g_trace_is_replay) {
+		return;
+	}
 	pid = fork();
 	if (0 > pid) {
 		warn("Could not fork for '%s'", arg0);
@@ -586,38 +864,71 @@ action_exec(struct Arg const *a_arg)
 	}
 }
 
+/*
+ * Sorts the clients once, biggest first, and packs them bottom-left onto a
+ * skyline below the bar. Clients that do not fit anywhere fall back on
+ * client_place once the rest are packed. Nothing is moved until everything
+ * has been placed.
+ */
 void
 action_furnish(struct Arg const *a_arg)
 {
-	struct Client *c, *prev_focus;
-	int num = 0;
+	struct View const *view;
+	struct Client **order, *c, *prev_focus;
+	char *is_packed;
+	size_t i, num = 0;
 
 	(void)a_arg;
 	prev_focus = g_focus;
 	TAILQ_FOREACH(c, &g_client_list[g_workspace_cur], next) {
-		c->x += 100000;
 		++num;
 	}
-	while (0 < num--) {
-		struct Client *best_client = NULL;
-		int best_size = 0, best_ofs = 0;
-
-		TAILQ_FOREACH(c, &g_client_list[g_workspace_cur], next) {
-			int const c_size = c->width * c->height;
-			int const c_ofs = c->x + 10000 * c->y;
+	if (0 == num) {
+		return;
+	}
+	CALLOC(order, num);
+	CALLOC(is_packed, num);
+	i = 0;
+	TAILQ_FOREACH(c, &g_client_list[g_workspace_cur], next) {
+		order[i++] = c;
+	}
+	qsort(order, num, sizeof *order, furnish_cmp);
+	for (i = 0; num > i; ++i) {
+		order[i]->x += 100000;
+	}
 
-			if (10000 > c->x) {
-				continue;
-			}
-			if (c_size > best_size ||
-			    (c_size == best_size && c_ofs < best_ofs)) {
-				best_client = c;
-				best_size = c_size;
-				best_ofs = c_ofs;
-			}
+	view = TAILQ_FIRST(&g_view_list);
+	REALLOC(g_skyline, 2 * num + 1);
+	REALLOC(g_skyline_tmp, 2 * num + 1);
+	g_skyline[0].x = VIEW_LEFT(view);
+	g_skyline[0].y = VIEW_TOP(view) + g_font_height;
+	g_skyline[0].width = view->width;
+	g_skyline_num = 1;
+	for (i = 0; num > i; ++i) {
+		int x, y;
+
+		c = order[i];
+		if (skyline_fit(WIDTH_B(c), HEIGHT_B(c), VIEW_BOTTOM(view),
+		    &x, &y)) {
+			c->x = x;
+			c->y = y;
+			skyline_add(x, y + HEIGHT_B(c), WIDTH_B(c));
+			is_packed[i] = 1;
+		}
+	}
+	/* Misfits avoid everything packed, and each other. */
+	for (i = 0; num > i; ++i) {
+		c = order[i];
+		if (!is_packed[i]) {
+			c->x -= 100000;
+			client_place(c, g_workspace_cur);
 		}
-		client_place(best_client);
 	}
+	for (i = 0; num > i; ++i) {
+		client_move(order[i], VISIBLE);
+	}
+	free(order);
+	free(is_packed);
 	client_focus(prev_focus, 0, 0, 1);
 }
 
@@ -625,6 +936,7 @@ void
 action_kill(struct Arg const *a_arg)
 {
 	xcb_icccm_get_wm_protocols_reply_t proto;
+	xcb_get_property_reply_t *reply;
 	size_t i;
 	int has_delete = 0;
 
@@ -632,14 +944,16 @@ action_kill(struct Arg const *a_arg)
 	if (!g_focus) {
 		return;
 	}
-	ZERO(proto);
-	xcb_icccm_get_wm_protocols_reply(g_conn,
-	    xcb_icccm_get_wm_protocols(g_conn, g_focus->window,
-	    g_WM_PROTOCOLS), &proto, NULL);
-	for (i = 0; proto.atoms_len > i; ++i) {
-		has_delete |= g_WM_DELETE_WINDOW == proto.atoms[i];
+	if ((reply = REPLY_PROPERTY(xcb_icccm_get_wm_protocols(g_conn,
+	    g_focus->window, g_WM_PROTOCOLS)))) {
+		if (xcb_icccm_get_wm_protocols_from_reply(reply, &proto)) {
+			for (i = 0; proto.atoms_len > i; ++i) {
+				has_delete |= g_WM_DELETE_WINDOW ==
+				    proto.atoms[i];
+			}
+		}
+		free(reply);
 	}
-	xcb_icccm_get_wm_protocols_reply_wipe(&proto);
 	if (has_delete) {
 		xcb_client_message_event_t ev;
 
@@ -663,6 +977,34 @@ action_quit(struct Arg const *a_arg)
 	g_run = a_arg->i;
 }
 
+/* Runs a bound action and holds it to its round trip budget. */
+void
+action_run(void (*a_action)(struct Arg const *), struct Arg const *a_arg)
+{
+	struct Audit *audit;
+	unsigned long reply_num;
+	size_t i;
+
+	for (i = 0; LENGTH(g_audit) - 1 > i && a_action !=
+	    g_audit[i].action; ++i)
+		;
+	audit = &g_audit[i];
+	reply_num = audit->reply_num;
+	g_audit_cur = audit;
+	a_action(a_arg);
+	g_audit_cur = NULL;
+	reply_num = audit->reply_num - reply_num;
+	++audit->run_num;
+	audit->reply_max = MAX(audit->reply_max, reply_num);
+	if (g_audit_is_strict && 0 <= audit->budget &&
+	    (unsigned long)audit->budget < reply_num) {
+		stats_print();
+		errx(EXIT_FAILURE, "Action '%s' made %lu round trips, budget "
+		    "is %d, see '%s'.", audit->name, reply_num, audit->budget,
+		    c_stats_file);
+	}
+}
+
 void
 action_workspace_select(struct Arg const *a_arg)
 {
@@ -679,92 +1021,303 @@ action_workspace_select(struct Arg const *a_arg)
 	TAILQ_FOREACH(c, &g_client_list[g_workspace_cur], next) {
 		client_move(c, VISIBLE);
 	}
+	g_has_name_dirty = 1;
 	client_focus(NULL, 1, 0, 0);
 }
 
-xcb_atom_t
-atom_get(char const *a_name)
+/*
+ * Attributes a round trip to its line and to the innermost action or event
+ * being handled, scopes past the event types are actions.
+ */
+void
+audit_count(int a_line)
 {
-	xcb_intern_atom_reply_t *reply;
-	xcb_atom_t atom;
+	struct AuditSite *site;
+	size_t i;
+	int scope;
 
-	if (!(reply = xcb_intern_atom_reply(g_conn, xcb_intern_atom(g_conn, 1,
-	    strlen(a_name), a_name), NULL))) {
-		errx(EXIT_FAILURE, "Could not get atom '%s'.", a_name);
+	if (g_audit_cur) {
+		++g_audit_cur->reply_num;
+		scope = LENGTH(g_audit_event) + (g_audit_cur - g_audit);
+	} else {
+		scope = g_audit_event_type;
+		if (0 <= scope) {
+			++g_audit_event[scope];
+		}
+	}
+	for (i = 0; g_audit_site_num > i; ++i) {
+		site = &g_audit_site[i];
+		if (scope == site->scope && a_line == site->line) {
+			++site->num;
+			return;
+		}
+	}
+	if (g_audit_site_cap == g_audit_site_num) {
+		g_audit_site_cap = MAX(16, 2 * g_audit_site_cap);
+		REALLOC(g_audit_site, g_audit_site_cap);
 	}
-	atom = reply->atom;
-	free(reply);
-	return atom;
+	site = &g_audit_site[g_audit_site_num++];
+	site->scope = scope;
+	site->line = a_line;
+	site->num = 1;
+}
+
+void
+bar_blink()
+{
+	g_blink ^= 1;
+	g_do_bar_redraw = 1;
+	timer_add(c_timeout_blink, bar_blink);
+}
+
+void
+bar_damage(int a_x0, int a_x1)
+{
+	struct Span *span;
+
+	span = &g_span[g_span_num++];
+	span->x0 = a_x0;
+	span->x1 = a_x1;
 }
 
+/* Every output has its own bar, the primary one also shows the status. */
 void
 bar_draw()
 {
-	xcb_rectangle_t rect;
-	struct View const *view;
+	struct View *view;
+	double t0;
+
+	t0 = time_get();
+	g_has_urgent = g_is_root_urgent;
+	TAILQ_FOREACH(view, &g_view_list, next) {
+		bar_draw_view(view);
+	}
+	histogram_add(&g_hist_probe[PROBE_BAR_DRAW], t0);
+}
+
+/*
+ * The bar is laid out into a segment table which is compared to the one of
+ * the previous draw. Spans covered by changed segments are grown until no
+ * segment straddles a span edge, and only those spans are repainted and
+ * copied to the window.
+ */
+void
+bar_draw_view(struct View *a_view)
+{
 	struct Client *c;
-	size_t i;
-	int x;
+	struct Segment *seg, *tmp;
+	size_t i, j, num;
+	int x, x_status, do_grow, is_primary;
 
-	view = TAILQ_FIRST(&g_view_list);
-	rect.x = 0;
-	rect.y = 0;
-	rect.width = view->width;
-	rect.height = g_font_height;
-	xcb_change_gc(g_conn, g_gc, XCB_GC_FOREGROUND, &g_color_bar_bg);
-	xcb_poly_fill_rectangle(g_conn, g_pixmap, g_gc, 1, &rect);
+	is_primary = a_view == TAILQ_FIRST(&g_view_list);
+	num = LENGTH(c_workspace_label) + 1 + LENGTH(c_status_bind);
+	TAILQ_FOREACH(c, &g_client_list[g_workspace_cur], next) {
+		++num;
+	}
+	if (a_view->segment_cap < num) {
+		a_view->segment_cap = 2 * num;
+		REALLOC(a_view->segment, a_view->segment_cap);
+		REALLOC(a_view->segment_next, a_view->segment_cap);
+	}
+	if (g_span_cap < 2 * num + 1) {
+		g_span_cap = 2 * (2 * num + 1);
+		REALLOC(g_span, g_span_cap);
+	}
 
-	g_has_urgent = g_is_root_urgent;
-	for (x = i = 0; LENGTH(c_workspace_label) > i; ++i) {
+	/* Layout. */
+	seg = a_view->segment_next;
+	for (x = i = 0; LENGTH(c_workspace_label) > i; ++i, ++seg) {
 		int is_urgent = 0;
 
 		TAILQ_FOREACH(c, &g_client_list[i], next) {
 			g_has_urgent |= is_urgent |= c->is_urgent;
 		}
-		x += text_draw(&g_workspace_label[i], g_workspace_cur == i,
-		    is_urgent, x, 0);
-		if (!TAILQ_EMPTY(&g_client_list[i])) {
-			rect.x = x - 4;
-			rect.width = 3;
-			rect.height = 3;
-			xcb_poly_rectangle(g_conn, g_pixmap, g_gc, 1, &rect);
+		seg->text = &g_workspace_label[i];
+		seg->x = x;
+		seg->scheme = scheme_get(g_workspace_cur == i, is_urgent);
+		seg->has_mark = !TAILQ_EMPTY(&g_client_list[i]);
+		x += seg->width = text_width(seg->text);
+	}
+	/* Status modules right-aligned, empty ones are left out. */
+	x_status = a_view->width;
+	for (i = LENGTH(c_status_bind); is_primary && 0 < i--;) {
+		struct Status const *st = &g_status[i];
+
+		if (0 == st->text.length) {
+			continue;
 		}
+		g_has_urgent |= st->is_urgent;
+		seg->text = &st->text;
+		x_status -= seg->width = text_width(seg->text);
+		seg->x = x_status;
+		seg->scheme = scheme_get(0, st->is_urgent);
+		seg->has_mark = 0;
+		++seg;
+	}
+	if (is_primary && (g_has_root_name || a_view->width == x_status)) {
+		seg->text = &g_root_name;
+		x_status -= seg->width = text_width(seg->text);
+		seg->x = x_status;
+		seg->scheme = scheme_get(0, g_is_root_urgent);
+		seg->has_mark = 0;
+		++seg;
 	}
-	text_draw(&g_root_name, 0, g_is_root_urgent, VIEW_RIGHT(view) -
-	    text_width(&g_root_name), 0);
+	a_view->status_width = a_view->width - x_status;
 	TAILQ_FOREACH(c, &g_client_list[g_workspace_cur], next) {
-		x += text_draw(&c->name, g_focus == c, c->is_urgent, x, 0);
+		if (a_view != view_find(c->x + WIDTH_B(c) / 2, c->y +
+		    HEIGHT_B(c) / 2)) {
+			continue;
+		}
+		seg->text = &c->name;
+		seg->x = x;
+		seg->scheme = scheme_get(g_focus == c, c->is_urgent);
+		seg->has_mark = 0;
+		x += seg->width = text_width(seg->text);
+		++seg;
+	}
+	num = seg - a_view->segment_next;
+	for (i = 0; num > i; ++i) {
+		struct String const *text;
+		unsigned char const *u;
+		uint32_t h = 2166136261u;
+
+		seg = &a_view->segment_next[i];
+		text = seg->text;
+		u = (unsigned char const *)text->str;
+		for (j = 0; 2 * text->length > j; ++j) {
+			h = (h ^ u[j]) * 16777619u;
+		}
+		seg->hash = h ^ text->length;
+	}
+
+	/* Damage. */
+	g_span_num = 0;
+	if (a_view->is_bar_reset) {
+		bar_damage(0, a_view->width);
+		a_view->is_bar_reset = 0;
+	}
+	for (i = 0; num > i; ++i) {
+		seg = &a_view->segment_next[i];
+		if (a_view->segment_num > i) {
+			struct Segment const *old = &a_view->segment[i];
+
+			if (old->x == seg->x && old->width == seg->width &&
+			    old->scheme == seg->scheme && old->has_mark ==
+			    seg->has_mark && old->hash == seg->hash) {
+				continue;
+			}
+			bar_damage(old->x, old->x + old->width);
+		}
+		bar_damage(seg->x, seg->x + seg->width);
+	}
+	for (; a_view->segment_num > i; ++i) {
+		bar_damage(a_view->segment[i].x, a_view->segment[i].x +
+		    a_view->segment[i].width);
+	}
+	do {
+		size_t k;
+
+		/* Sort and merge spans. */
+		for (i = 1; g_span_num > i; ++i) {
+			struct Span span = g_span[i];
+
+			for (j = i; 0 < j && g_span[j - 1].x0 > span.x0; --j) {
+				g_span[j] = g_span[j - 1];
+			}
+			g_span[j] = span;
+		}
+		for (i = k = 0; g_span_num > i; ++i) {
+			if (0 < k && g_span[k - 1].x1 >= g_span[i].x0) {
+				g_span[k - 1].x1 = MAX(g_span[k - 1].x1,
+				    g_span[i].x1);
+			} else {
+				g_span[k++] = g_span[i];
+			}
+		}
+		g_span_num = k;
+
+		/* Repainting a segment must not clobber undamaged pixels. */
+		do_grow = 0;
+		for (i = 0; g_span_num > i; ++i) {
+			struct Span *span = &g_span[i];
+
+			for (j = 0, seg = a_view->segment_next; num > j; ++j,
+			    ++seg) {
+				if (seg->x < span->x1 && span->x0 < seg->x +
+				    seg->width && (seg->x < span->x0 ||
+				    span->x1 < seg->x + seg->width)) {
+					span->x0 = MIN(span->x0, seg->x);
+					span->x1 = MAX(span->x1, seg->x +
+					    seg->width);
+					do_grow = 1;
+				}
+			}
+		}
+	} while (do_grow);
+
+	/* Paint. */
+	for (i = 0; g_span_num > i; ++i) {
+		struct Span const *span = &g_span[i];
+		xcb_rectangle_t rect;
+
+		rect.x = span->x0;
+		rect.y = 0;
+		rect.width = span->x1 - span->x0;
+		rect.height = g_font_height;
+		xcb_poly_fill_rectangle(g_conn, a_view->pixmap,
+		    g_gc_fill[SCHEME_NORMAL], 1, &rect);
+		for (j = 0, seg = a_view->segment_next; num > j; ++j, ++seg) {
+			if (seg->x >= span->x1 || span->x0 >= seg->x +
+			    seg->width) {
+				continue;
+			}
+			text_draw(a_view->pixmap, seg->text, seg->scheme,
+			    seg->x, 0);
+			if (seg->has_mark) {
+				rect.x = seg->x + seg->width - 4;
+				rect.width = 3;
+				rect.height = 3;
+				xcb_poly_rectangle(g_conn, a_view->pixmap,
+				    g_gc_text[seg->scheme], 1, &rect);
+			}
+		}
+		xcb_copy_area(g_conn, a_view->pixmap, a_view->bar,
+		    g_gc_fill[SCHEME_NORMAL], span->x0, 0, span->x0, 0,
+		    span->x1 - span->x0, g_font_height);
 	}
 
-	xcb_copy_area(g_conn, g_pixmap, g_bar, g_gc, 0, 0, 0, 0,
-	    VIEW_RIGHT(view), g_font_height);
+	tmp = a_view->segment;
+	a_view->segment = a_view->segment_next;
+	a_view->segment_next = tmp;
+	a_view->segment_num = num;
 }
 
 void
-bar_reset()
+bar_reset(struct View *a_view)
 {
-	struct View const *view;
-
-	if (XCB_NONE != g_bar) {
-		xcb_destroy_window(g_conn, g_bar);
-		xcb_free_pixmap(g_conn, g_pixmap);
+	if (XCB_NONE != a_view->bar) {
+		xcb_destroy_window(g_conn, a_view->bar);
+		xcb_free_pixmap(g_conn, a_view->pixmap);
 	}
 
-	g_pixmap = xcb_generate_id(g_conn);
-	view = TAILQ_FIRST(&g_view_list);
-	xcb_create_pixmap(g_conn, g_screen->root_depth, g_pixmap, g_root,
-	    view->width, g_font_height);
+	a_view->pixmap = xcb_generate_id(g_conn);
+	xcb_create_pixmap(g_conn, g_screen->root_depth, a_view->pixmap,
+	    g_root, a_view->width, g_font_height);
 
-	g_bar = xcb_generate_id(g_conn);
+	a_view->bar = xcb_generate_id(g_conn);
 	g_values[0] = g_color_bar_bg;
 	g_values[1] = 1;
 	g_values[2] = XCB_EVENT_MASK_BUTTON_PRESS | XCB_EVENT_MASK_EXPOSURE;
-	xcb_create_window(g_conn, XCB_COPY_FROM_PARENT, g_bar, g_root,
-	    view->x, view->y, view->width, g_font_height, 0,
+	xcb_create_window(g_conn, XCB_COPY_FROM_PARENT, a_view->bar, g_root,
+	    a_view->x, a_view->y, a_view->width, g_font_height, 0,
 	    XCB_WINDOW_CLASS_INPUT_OUTPUT, XCB_COPY_FROM_PARENT,
 	    XCB_CW_BACK_PIXEL | XCB_CW_OVERRIDE_REDIRECT | XCB_CW_EVENT_MASK,
 	    g_values);
-	xcb_map_window(g_conn, g_bar);
+	xcb_map_window(g_conn, a_view->bar);
+
+	a_view->is_bar_reset = 1;
+	a_view->segment_num = 0;
+	g_do_bar_redraw = 1;
 }
 
 void
@@ -787,111 +1340,125 @@ button_grab(struct Client *a_client)
 struct Client *
 client_add(xcb_window_t a_window, xcb_window_t a_parent)
 {
-	int data = -1;
+	struct Adopt adopt;
 
-	return client_add_details(a_window, a_parent, &data);
+	adopt.window = a_window;
+	adopt.parent = a_parent;
+	adopt.data[0] = -1;
+	client_adopt(&adopt, 1);
+	return adopt.client;
 }
 
+/*
+ * Collects the replies requested by client_adopt for one window, nothing
+ * here waits on anything that was not already in flight.
+ */
 struct Client *
-client_add_details(xcb_window_t a_window, xcb_window_t a_parent, int const
-    *a_data)
+client_add_details(struct Adopt *a_adopt)
 {
 	xcb_get_window_attributes_reply_t *attr;
 	xcb_get_geometry_reply_t *geom;
-	xcb_query_pointer_reply_t *query;
+	xcb_get_property_reply_t *hints;
 	struct View const *view;
 	struct Client *c;
+	int const *data = a_adopt->data;
 	size_t workspace;
+	int is_managed = 1;
 
-	if (a_window == g_root) {
-		return NULL;
-	}
-	if ((attr = xcb_get_window_attributes_reply(g_conn,
-	    xcb_get_window_attributes(g_conn, a_window), NULL))) {
-		if (XCB_MAP_STATE_VIEWABLE != attr->map_state ||
-		    attr->override_redirect) {
-			free(attr);
-			return NULL;
-		}
+	if ((attr = REPLY(xcb_get_window_attributes_reply(g_conn,
+	    a_adopt->attr, NULL)))) {
+		is_managed = XCB_MAP_STATE_VIEWABLE == attr->map_state &&
+		    !attr->override_redirect;
 		free(attr);
 	}
-
-	if (!(geom = xcb_get_geometry_reply(g_conn,
-	    xcb_get_geometry(g_conn, a_window), NULL))) {
-		fprintf(stderr, "client_add_details: Could not get geometry "
-		    "of window 0x%08x.\n", a_window);
+	geom = REPLY(xcb_get_geometry_reply(g_conn, a_adopt->geom, NULL));
+	if (!is_managed || !geom) {
+		if (is_managed) {
+			fprintf(stderr, "client_add_details: Could not get "
+			    "geometry of window 0x%08x.\n", a_adopt->window);
+		}
+		free(geom);
+		xcb_discard_reply(g_conn, a_adopt->hints.sequence);
+		xcb_discard_reply(g_conn, a_adopt->wm_hints.sequence);
+		xcb_discard_reply(g_conn, a_adopt->name.net_wm_name.sequence);
+		xcb_discard_reply(g_conn, a_adopt->name.wm_name.sequence);
 		return NULL;
 	}
 
 	CALLOC(c, 1);
-	c->window = a_window;
+	c->window = a_adopt->window;
 	c->hints.flags = 0;
-	xcb_icccm_get_wm_normal_hints_reply(g_conn,
-	    xcb_icccm_get_wm_normal_hints(g_conn, a_window), &c->hints, NULL);
-	client_name_update(c);
-	query = xcb_query_pointer_reply(g_conn, xcb_query_pointer(g_conn,
-	    g_root), NULL);
-	view = view_find(query->root_x, query->root_y);
-	free(query);
+	if ((hints = REPLY_PROPERTY(a_adopt->hints))) {
+		xcb_icccm_get_wm_size_hints_from_reply(&c->hints, hints);
+		free(hints);
+	}
+	if ((hints = REPLY_PROPERTY(a_adopt->wm_hints))) {
+		xcb_icccm_get_wm_hints_from_reply(&c->wm_hints, hints);
+		free(hints);
+	}
+	client_name_reply(c, &a_adopt->name);
+	view = view_find(g_pointer_x, g_pointer_y);
 	c->x = view->x;
 	c->y = view->y;
 	c->width = geom->width;
 	c->height = geom->height;
+	c->sent.x = geom->x;
+	c->sent.y = geom->y;
+	c->sent.width = geom->width;
+	c->sent.height = geom->height;
+	c->sent.border_width = geom->border_width;
+	/* Not known, so it differs from anything wanted. */
+	c->sent.border_color = ~g_color_border_unfocus;
+	c->want = c->sent;
 	free(geom);
-	if (0 > a_data[0]) {
-		if (XCB_WINDOW_NONE != a_parent) {
-			/* TODO: Find parent workspace. */
-			for (workspace = 0; LENGTH(c_workspace_label) >
-			    workspace; ++workspace) {
-				struct Client *rover;
-
-				TAILQ_FOREACH(rover, &g_client_list[
-				    workspace], next) {
-					if (rover->window == a_parent) {
-						goto found_parent;
-					}
-				}
-			}
-			workspace = g_workspace_cur;
+	if (0 > data[0]) {
+		size_t parent_workspace;
+
+		if (XCB_WINDOW_NONE != a_adopt->parent &&
+		    client_get(a_adopt->parent, &parent_workspace)) {
+			workspace = parent_workspace;
+		} else {
 			/*
-			 * Parent is probably overriding, such megalomania
-			 * will result in "unnatural" behaviour.
+			 * No parent or the parent is probably overriding,
+			 * such megalomania will result in "unnatural"
+			 * behaviour.
 			 */
-		} else {
 			workspace = g_workspace_cur;
 		}
-found_parent:
 		g_do_bar_redraw = c->is_urgent = g_workspace_cur != workspace;
 		c->maximize = MAX_NOPE;
 		c->border_width = c->width != view->width || c->height !=
 		    view->height;
 		c->max_old_y = c->max_old_x = 0;
 		c->max_old_height = c->max_old_width = 0;
-		client_place(c);
+		client_place(c, workspace);
+		client_move(c, VISIBLE);
 	} else {
-		workspace = a_data[0];
-		g_do_bar_redraw = c->is_urgent = a_data[1];
-		c->x = a_data[2];
-		c->y = a_data[3];
-		c->maximize = a_data[4];
-		c->border_width = a_data[5];
-		c->max_old_x = a_data[6];
-		c->max_old_y = a_data[7];
-		c->max_old_width = a_data[8];
-		c->max_old_height = a_data[9];
+		workspace = data[0];
+		g_do_bar_redraw = c->is_urgent = data[1];
+		c->x = data[2];
+		c->y = data[3];
+		c->maximize = data[4];
+		c->border_width = data[5];
+		c->max_old_x = data[6];
+		c->max_old_y = data[7];
+		c->max_old_width = data[8];
+		c->max_old_height = data[9];
 	}
 	TAILQ_INSERT_HEAD(&g_client_list[workspace], c, next);
+	client_slot_set(c, workspace);
+	edge_insert(c, workspace);
+	ewmh_client_add(c->window, workspace);
 
 	button_grab(c);
 
-	g_values[0] = g_color_border_unfocus;
-	g_values[1] = XCB_EVENT_MASK_ENTER_WINDOW |
+	g_values[0] = XCB_EVENT_MASK_ENTER_WINDOW |
 	    XCB_EVENT_MASK_STRUCTURE_NOTIFY | XCB_EVENT_MASK_PROPERTY_CHANGE;
-	xcb_change_window_attributes(g_conn, a_window, XCB_CW_BORDER_PIXEL |
-	    XCB_CW_EVENT_MASK, g_values);
-	g_values[0] = c->border_width;
-	xcb_configure_window(g_conn, a_window, XCB_CONFIG_WINDOW_BORDER_WIDTH,
+	xcb_change_window_attributes(g_conn, c->window, XCB_CW_EVENT_MASK,
 	    g_values);
+	c->want.border_color = g_color_border_unfocus;
+	c->want.border_width = c->border_width;
+	txn_touch(c);
 
 	if (g_workspace_cur != workspace) {
 		client_move(c, HIDDEN);
@@ -899,16 +1466,72 @@ found_parent:
 	return c;
 }
 
+/*
+ * Adopts a batch of windows: every request for every window goes out first
+ * and the replies are collected afterwards, so the whole batch costs one
+ * round trip.
+ */
 void
-client_free(struct Client **a_client)
+client_adopt(struct Adopt *a_adopt, size_t a_num)
 {
-	struct Client *c;
+	xcb_query_pointer_cookie_t pointer_cookie;
+	xcb_query_pointer_reply_t *pointer_reply;
+	size_t i;
+
+	/*
+	 * New windows go on the output with the pointer, which may have moved
+	 * there without crossing any window, so ask along with the rest.
+	 */
+	pointer_cookie = xcb_query_pointer(g_conn, g_root);
+	for (i = 0; a_num > i; ++i) {
+		struct Adopt *adopt = &a_adopt[i];
+
+		adopt->client = NULL;
+		if (g_root == adopt->window) {
+			continue;
+		}
+		adopt->attr = xcb_get_window_attributes(g_conn,
+		    adopt->window);
+		adopt->geom = xcb_get_geometry(g_conn, adopt->window);
+		adopt->hints = xcb_icccm_get_wm_normal_hints(g_conn,
+		    adopt->window);
+		adopt->wm_hints = xcb_icccm_get_wm_hints(g_conn,
+		    adopt->window);
+		client_name_request(adopt->window, &adopt->name);
+	}
+	if ((pointer_reply = REPLY(xcb_query_pointer_reply(g_conn,
+	    pointer_cookie, NULL)))) {
+		g_pointer_x = pointer_reply->root_x;
+		g_pointer_y = pointer_reply->root_y;
+		free(pointer_reply);
+	}
+	for (i = 0; a_num > i; ++i) {
+		if (g_root != a_adopt[i].window) {
+			a_adopt[i].client = client_add_details(&a_adopt[i]);
+		}
+	}
+}
+
+void
+client_free(struct Client **a_client)
+{
+	struct ClientSlot *slot;
+	struct Client *c;
 
 	c = *a_client;
 	if (!c) {
 		return;
 	}
-	TAILQ_REMOVE(&g_client_list[g_workspace_cur], c, next);
+	slot = client_slot_find(c->window);
+	assert(slot);
+	TAILQ_REMOVE(&g_client_list[slot->workspace], c, next);
+	edge_remove(c, slot->workspace);
+	slot->client = NULL;
+	--g_client_slot_live;
+	ewmh_client_remove(c->window);
+	if (g_txn_top == c->window) {
+		g_txn_top = XCB_NONE;
+	}
 	free(c);
 	if (c == g_focus) {
 		client_focus(g_focus = NULL, 1, 0, 0);
@@ -920,13 +1543,10 @@ void
 client_focus(struct Client *a_client, int a_do_reorder, int const a_do_raise,
     int a_do_warp)
 {
-	xcb_icccm_wm_hints_t hints;
-
 	g_do_bar_redraw = 1;
 	if (g_focus) {
-		g_values[0] = g_color_border_unfocus;
-		xcb_change_window_attributes(g_conn, g_focus->window,
-		    XCB_CW_BORDER_PIXEL, g_values);
+		g_focus->want.border_color = g_color_border_unfocus;
+		txn_touch(g_focus);
 	}
 	g_focus = a_client ? a_client :
 	    TAILQ_FIRST(&g_client_list[g_workspace_cur]);
@@ -934,10 +1554,11 @@ client_focus(struct Client *a_client, int a_do_reorder, int const a_do_raise,
 		return;
 	}
 
-	if (xcb_icccm_get_wm_hints_reply(g_conn,
-	    xcb_icccm_get_wm_hints(g_conn, g_focus->window), &hints, NULL)) {
-		hints.flags &= ~XCB_ICCCM_WM_HINT_X_URGENCY;
-		xcb_icccm_set_wm_hints(g_conn, g_focus->window, &hints);
+	/* WM_HINTS are tracked from property notifies, no round trip. */
+	if (XCB_ICCCM_WM_HINT_X_URGENCY & g_focus->wm_hints.flags) {
+		g_focus->wm_hints.flags &= ~XCB_ICCCM_WM_HINT_X_URGENCY;
+		xcb_icccm_set_wm_hints(g_conn, g_focus->window,
+		    &g_focus->wm_hints);
 	}
 	g_focus->is_urgent = 0;
 	if (a_do_reorder) {
@@ -946,17 +1567,16 @@ client_focus(struct Client *a_client, int a_do_reorder, int const a_do_raise,
 		    next);
 	}
 	if (a_do_raise) {
-		g_values[0] = XCB_STACK_MODE_TOP_IF;
-		xcb_configure_window(g_conn, g_focus->window,
-		    XCB_CONFIG_WINDOW_STACK_MODE, g_values);
+		g_txn_raise = g_focus->window;
 	}
+	g_focus->want.border_color = g_color_border_focus;
+	txn_touch(g_focus);
 	if (a_do_warp) {
+		/* Warps are relative to where the window is on the server. */
+		txn_commit();
 		xcb_warp_pointer(g_conn, XCB_NONE, g_focus->window, 0, 0, 0,
 		    0, g_focus->width / 2, g_focus->height / 2);
 	}
-	g_values[0] = g_color_border_focus;
-	xcb_change_window_attributes(g_conn, g_focus->window,
-	    XCB_CW_BORDER_PIXEL, g_values);
 	xcb_set_input_focus(g_conn, XCB_INPUT_FOCUS_POINTER_ROOT,
 	    g_focus->window, XCB_CURRENT_TIME);
 }
@@ -964,145 +1584,207 @@ client_focus(struct Client *a_client, int a_do_reorder, int const a_do_raise,
 struct Client *
 client_get(xcb_window_t a_window, size_t *a_workspace)
 {
-	struct Client *c;
-	size_t i;
+	struct ClientSlot const *slot;
 
-	for (i = 0; LENGTH(c_workspace_label) > i; ++i) {
-		TAILQ_FOREACH(c, &g_client_list[i], next) {
-			if (a_window == c->window) {
-				a_workspace ? *a_workspace = i : 0;
-				return c;
-			}
-		}
+	if (!(slot = client_slot_find(a_window))) {
+		return NULL;
 	}
-	return NULL;
+	a_workspace ? *a_workspace = slot->workspace : 0;
+	return slot->client;
 }
 
 void
 client_move(struct Client *a_client, enum Visibility a_visibility)
 {
 	if (VISIBLE == a_visibility) {
-		g_values[0] = a_client->x;
-		g_values[1] = a_client->y;
+		edge_update(a_client);
+		a_client->want.x = a_client->x;
+		a_client->want.y = a_client->y;
+		/* May have crossed into the bar of another output. */
+		if (TAILQ_NEXT(TAILQ_FIRST(&g_view_list), next)) {
+			g_do_bar_redraw = 1;
+		}
 	} else {
-		g_values[0] = 10000;
-		g_values[1] = 0;
+		a_client->want.x = 10000;
+		a_client->want.y = 0;
+	}
+	txn_touch(a_client);
+}
+
+/*
+ * Fetches the dirty names on the shown workspace, all requests before any
+ * reply, and each client at most c_title_rate times a second. Hidden names
+ * wait until their workspace is shown. The bar is only redrawn for names
+ * that did change.
+ */
+void
+client_name_flush()
+{
+	struct Client *c, **client;
+	struct NameCookie *cookie;
+	double now, next;
+	size_t i, num;
+
+	g_has_name_dirty = 0;
+	num = 0;
+	TAILQ_FOREACH(c, &g_client_list[g_workspace_cur], next) {
+		num += c->is_name_dirty;
+	}
+	if (0 == num) {
+		return;
+	}
+	CALLOC(client, num);
+	CALLOC(cookie, num);
+	now = time_get();
+	next = -1;
+	num = 0;
+	TAILQ_FOREACH(c, &g_client_list[g_workspace_cur], next) {
+		double due;
+
+		if (!c->is_name_dirty) {
+			continue;
+		}
+		due = c->name_time + (0 < c_title_rate ? 1e3 / c_title_rate :
+		    0);
+		/* Traces match replies by order, so no throttling then. */
+		if (now < due && !g_trace) {
+			if (0 > next || next > due) {
+				next = due;
+			}
+			continue;
+		}
+		client[num] = c;
+		client_name_request(c->window, &cookie[num++]);
+	}
+	for (i = 0; num > i; ++i) {
+		struct String old;
+
+		c = client[i];
+		old = c->name;
+		client_name_reply(c, &cookie[i]);
+		if (old.length != c->name.length || 0 != memcmp(old.str,
+		    c->name.str, old.length * sizeof *old.str)) {
+			g_do_bar_redraw = 1;
+		}
+		c->is_name_dirty = 0;
+		c->name_time = now;
+	}
+	free(client);
+	free(cookie);
+	if (0 <= next) {
+		timer_add(next - now, client_name_flush);
 	}
-	xcb_configure_window(g_conn, a_client->window, XCB_CONFIG_WINDOW_X |
-	    XCB_CONFIG_WINDOW_Y, g_values);
 }
 
 void
-client_name_update(struct Client *a_client)
+client_name_reply(struct Client *a_client, struct NameCookie const *a_cookie)
 {
-	xcb_icccm_get_text_property_reply_t icccm;
 	xcb_get_property_reply_t *reply;
 
-	if ((reply = xcb_get_property_reply(g_conn, xcb_get_property(g_conn,
-	    0, a_client->window, g_NET_WM_NAME, XCB_GET_PROPERTY_TYPE_ANY, 0,
-	    UINT32_MAX), NULL))) {
+	if ((reply = REPLY_PROPERTY(a_cookie->net_wm_name))) {
 		string_convert(&a_client->name, xcb_get_property_value(reply),
 		    xcb_get_property_value_length(reply));
 		free(reply);
 		if (a_client->name.length) {
+			xcb_discard_reply(g_conn, a_cookie->wm_name.sequence);
 			return;
 		}
 	}
-	if (xcb_icccm_get_wm_name_reply(g_conn, xcb_icccm_get_wm_name(g_conn,
-	    a_client->window), &icccm, NULL)) {
-		string_convert(&a_client->name, icccm.name, icccm.name_len);
-		xcb_icccm_get_text_property_reply_wipe(&icccm);
-		return;
+	if ((reply = REPLY_PROPERTY(a_cookie->wm_name))) {
+		int const c_len = xcb_get_property_value_length(reply);
+
+		if (0 != c_len) {
+			string_convert(&a_client->name,
+			    xcb_get_property_value(reply), c_len);
+			free(reply);
+			return;
+		}
+		free(reply);
 	}
 	string_convert(&a_client->name, "<noname>", 8);
 }
 
 void
-client_place(struct Client *a_client)
+client_name_request(xcb_window_t a_window, struct NameCookie *a_cookie)
 {
+	a_cookie->net_wm_name = xcb_get_property(g_conn, 0, a_window,
+	    g_NET_WM_NAME, XCB_GET_PROPERTY_TYPE_ANY, 0, UINT32_MAX);
+	a_cookie->wm_name = xcb_icccm_get_wm_name(g_conn, a_window);
+}
+
+/*
+ * Walks candidate positions row by row, converging on sibling edges, and
+ * keeps the first one with the least overlap. The candidate edges are
+ * sorted up front and overlaps come from a summed-area table, see
+ * place_build, so each candidate costs O(1). Runs of candidates are skipped
+ * when the strip they all cover already overlaps too much.
+ */
+void
+client_place(struct Client *a_client, size_t a_workspace)
+{
+	struct Place const *p = &g_place;
 	struct View const *view;
-	int best_score = 1e9, best_x = 0, best_y = g_font_height, x, y =
-	    g_font_height - 1;
+	double best_score = 1e9;
+	size_t kx0, kx1, ky, k, x_end_cell0, x_end_cell1;
+	int best_x = 0, best_y = g_font_height, x_end, y_end, y;
+	int const c_width_b = WIDTH_B(a_client);
+	int const c_height_b = HEIGHT_B(a_client);
+	double const c_t0 = time_get();
 
 	view = view_find(a_client->x, a_client->y);
-	x = VIEW_RIGHT(view) - WIDTH_B(a_client);
-	for (;;) {
-		struct Client const *sibling;
-		int score = 0, new_x, new_y, test;
-
-		if (x + WIDTH_B(a_client) == VIEW_RIGHT(view)) {
-			int height_b = HEIGHT_B(a_client);
-
-			if (y + height_b == VIEW_BOTTOM(view)) {
-				break;
+	x_end = VIEW_RIGHT(view) - c_width_b;
+	y_end = VIEW_BOTTOM(view) - c_height_b;
+	place_build(a_client, a_workspace);
+	x_end_cell0 = place_cell(p->xs, p->mx, x_end);
+	x_end_cell1 = place_cell(p->xs, p->mx, x_end + c_width_b);
+	for (kx0 = 0; p->tx_num > kx0 && VIEW_LEFT(view) - 1 >= p->tx[kx0];
+	    ++kx0)
+		;
+	for (kx1 = kx0; p->tx_num > kx1 && x_end > p->tx[kx1]; ++kx1)
+		;
+	for (ky = 0; p->ty_num > ky && g_font_height - 1 >= p->ty[ky]; ++ky)
+		;
+	for (y = g_font_height - 1; y_end != y && 0 < best_score;) {
+		size_t y_cell0, y_cell1;
+		double score;
+
+		y = p->ty_num > ky && y_end > p->ty[ky] ? p->ty[ky++] : y_end;
+		y_cell0 = place_cell(p->ys, p->my, y);
+		y_cell1 = place_cell(p->ys, p->my, y + c_height_b);
+		for (k = kx0; kx1 > k;) {
+			size_t const c_run_end = MIN(k + 16, kx1);
+			size_t const c_last = c_run_end - 1;
+
+			if (p->tx[c_last] < p->tx[k] + c_width_b &&
+			    best_score <= place_area(p->tx[c_last],
+			    p->tx_cell0[c_last], p->tx[k] + c_width_b,
+			    p->tx_cell1[k], y, y_cell0, y_cell1)) {
+				k = c_run_end;
+				continue;
 			}
-			new_y = VIEW_BOTTOM(view) - height_b;
-			TAILQ_FOREACH(sibling,
-			    &g_client_list[g_workspace_cur], next) {
-				if (sibling != a_client) {
-					test = sibling->y - height_b;
-					CONVERGE(<, y, test, new_y);
-					test = sibling->y;
-					CONVERGE(<, y, test, new_y);
-					test = sibling->y + HEIGHT_B(sibling)
-					    - height_b;
-					CONVERGE(<, y, test, new_y);
-					test = sibling->y + HEIGHT_B(sibling);
-					CONVERGE(<, y, test, new_y);
+			for (; c_run_end > k; ++k) {
+				score = place_area(p->tx[k], p->tx_cell0[k],
+				    p->tx[k] + c_width_b, p->tx_cell1[k], y,
+				    y_cell0, y_cell1);
+				if (best_score > score) {
+					best_score = score;
+					best_x = p->tx[k];
+					best_y = y;
 				}
 			}
-			x = VIEW_LEFT(view) - 1;
-			test = g_font_height;
-			if (y < test && test < new_y) {
-				new_y = test;
-			}
-			y = new_y;
-		}
-		new_x = VIEW_RIGHT(view) - WIDTH_B(a_client);
-		TAILQ_FOREACH(sibling, &g_client_list[g_workspace_cur], next)
-		{
-			if (sibling != a_client) {
-				test = sibling->x - WIDTH_B(a_client);
-				CONVERGE(<, x, test, new_x);
-				test = sibling->x;
-				CONVERGE(<, x, test, new_x);
-				test = sibling->x + WIDTH_B(sibling) -
-				    WIDTH_B(a_client);
-				CONVERGE(<, x, test, new_x);
-				test = sibling->x + WIDTH_B(sibling);
-				CONVERGE(<, x, test, new_x);
-			}
-		}
-		test = 0;
-		if (x < test && test < new_x) {
-			new_x = test;
-		}
-		x = new_x;
-
-		TAILQ_FOREACH(sibling, &g_client_list[g_workspace_cur], next)
-		{
-			if (sibling != a_client) {
-				int x0 = MAX(x, sibling->x);
-				int y0 = MAX(y, sibling->y);
-				int x1 = MIN(x + WIDTH_B(a_client),
-				    sibling->x + WIDTH_B(sibling));
-				int y1 = MIN(y + HEIGHT_B(a_client),
-				    sibling->y + HEIGHT_B(sibling));
-				int s = MAX(0, x1 - x0) * MAX(0, y1 - y0);
-
-				score += s;
-			}
 		}
+		score = place_area(x_end, x_end_cell0, x_end + c_width_b,
+		    x_end_cell1, y, y_cell0, y_cell1);
 		if (best_score > score) {
 			best_score = score;
-			best_x = x;
+			best_x = x_end;
 			best_y = y;
 		}
 	}
 
-	a_client->x = MIN(best_x, VIEW_RIGHT(view) - WIDTH_B(a_client));
-	a_client->y = MIN(best_y, VIEW_BOTTOM(view) - HEIGHT_B(a_client));
-	client_move(a_client, VISIBLE);
+	a_client->x = MIN(best_x, x_end);
+	a_client->y = MIN(best_y, y_end);
+	histogram_add(&g_hist_probe[PROBE_CLIENT_PLACE], c_t0);
 }
 
 void
@@ -1139,28 +1821,129 @@ fflush(stdout);
 		a_client->width = MIN(a_client->width, hints->max_width);
 		a_client->height = MIN(a_client->height, hints->max_height);
 	}
-	g_values[0] = a_client->width;
-	g_values[1] = a_client->height;
-	xcb_configure_window(g_conn, a_client->window, XCB_CONFIG_WINDOW_WIDTH
-	    | XCB_CONFIG_WINDOW_HEIGHT, g_values);
+	edge_update(a_client);
+	a_client->want.width = a_client->width;
+	a_client->want.height = a_client->height;
+	txn_touch(a_client);
+}
+
+/*
+ * Window -> client index, open addressing with linear probing. A slot with a
+ * window but no client is a tombstone, XCB_NONE marks the end of a probe.
+ */
+struct ClientSlot *
+client_slot_find(xcb_window_t a_window)
+{
+	size_t i, mask;
+
+	if (0 == g_client_slot_num || XCB_NONE == a_window) {
+		return NULL;
+	}
+	mask = g_client_slot_num - 1;
+	for (i = client_slot_hash(a_window) & mask;; i = (i + 1) & mask) {
+		struct ClientSlot *slot = &g_client_slot[i];
+
+		if (XCB_NONE == slot->window) {
+			return NULL;
+		}
+		if (a_window == slot->window && slot->client) {
+			return slot;
+		}
+	}
+}
+
+size_t
+client_slot_hash(xcb_window_t a_window)
+{
+	uint32_t h;
+
+	/* XIDs differ mostly in the client base bits, fold them down. */
+	h = a_window ^ (a_window >> 16);
+	h *= 0x9e3779b1u;
+	return h ^ (h >> 16);
+}
+
+void
+client_slot_rehash()
+{
+	struct ClientSlot *old;
+	size_t i, mask, old_num;
+
+	old = g_client_slot;
+	old_num = g_client_slot_num;
+	for (g_client_slot_num = 64; 4 * g_client_slot_live >=
+	    g_client_slot_num; g_client_slot_num *= 2)
+		;
+	CALLOC(g_client_slot, g_client_slot_num);
+	mask = g_client_slot_num - 1;
+	for (i = 0; old_num > i; ++i) {
+		size_t j;
+
+		if (!old[i].client) {
+			continue;
+		}
+		for (j = client_slot_hash(old[i].window) & mask;
+		    XCB_NONE != g_client_slot[j].window; j = (j + 1) & mask)
+			;
+		g_client_slot[j] = old[i];
+	}
+	g_client_slot_used = g_client_slot_live;
+	free(old);
+}
+
+void
+client_slot_set(struct Client *a_client, size_t a_workspace)
+{
+	struct ClientSlot *slot, *tomb;
+	size_t i, mask;
+
+	if ((slot = client_slot_find(a_client->window))) {
+		slot->client = a_client;
+		slot->workspace = a_workspace;
+		return;
+	}
+	if (3 * g_client_slot_num <= 4 * (g_client_slot_used + 1)) {
+		client_slot_rehash();
+	}
+	tomb = NULL;
+	mask = g_client_slot_num - 1;
+	for (i = client_slot_hash(a_client->window) & mask;; i = (i + 1) &
+	    mask) {
+		slot = &g_client_slot[i];
+		if (XCB_NONE == slot->window) {
+			break;
+		}
+		if (!slot->client && !tomb) {
+			tomb = slot;
+		}
+	}
+	if (tomb) {
+		slot = tomb;
+	} else {
+		++g_client_slot_used;
+	}
+	slot->window = a_client->window;
+	slot->client = a_client;
+	slot->workspace = a_workspace;
+	++g_client_slot_live;
 }
 
 void
 client_snap_dimension(struct Client *a_client)
 {
 	struct View const *view;
-	struct Client const *sibling;
-	int ref;
+	int edge, ref;
 
 	view = view_find(a_client->x, a_client->y);
-	TAILQ_FOREACH(sibling, &g_client_list[g_workspace_cur], next) {
-		if (a_client == sibling) {
-			continue;
-		}
-		ref = sibling->x - a_client->x - 2;
-		SNAP(<, ref, a_client->width, ref + c_snap_margin);
-		ref = sibling->y - a_client->y - 2;
-		SNAP(<, ref, a_client->height, ref + c_snap_margin);
+	ref = a_client->x + a_client->width + 2;
+	if (edge_next(EDGE_LEFT, ref, -1, a_client, &edge) && ref -
+	    c_snap_margin < edge) {
+		a_client->width = edge - a_client->x - 2;
+	}
+	ref = a_client->y + a_client->height + 2;
+	if (edge_next(EDGE_TOP, ref, -1, a_client, &edge) && ref -
+	    c_snap_margin < edge) {
+		a_client->height = edge - a_client->y - 2;
 	}
 	ref = VIEW_RIGHT(view) - a_client->x - 2;
 	SNAP(<, ref, a_client->width, ref + c_snap_margin);
@@ -1172,22 +1955,26 @@ void
 client_snap_position(struct Client *a_client)
 {
 	struct View const *view;
-	struct Client const *sibling;
-	int ref;
+	int edge, ref;
 
 	view = view_find(a_client->x, a_client->y);
-	TAILQ_FOREACH(sibling, &g_client_list[g_workspace_cur], next) {
-		if (a_client == sibling) {
-			continue;
-		}
-		ref = sibling->x - WIDTH_B(a_client);
-		SNAP(<, ref, a_client->x, ref + c_snap_margin);
-		ref = sibling->x + WIDTH_B(sibling);
-		SNAP(>, ref, a_client->x, ref - c_snap_margin);
-		ref = sibling->y - HEIGHT_B(a_client);
-		SNAP(<, ref, a_client->y, ref + c_snap_margin);
-		ref = sibling->y + HEIGHT_B(sibling);
-		SNAP(>, ref, a_client->y, ref - c_snap_margin);
+	ref = a_client->x + WIDTH_B(a_client);
+	if (edge_next(EDGE_LEFT, ref, -1, a_client, &edge) && ref -
+	    c_snap_margin < edge) {
+		a_client->x = edge - WIDTH_B(a_client);
+	}
+	if (edge_next(EDGE_RIGHT, a_client->x, 1, a_client, &edge) && edge <
+	    a_client->x + c_snap_margin) {
+		a_client->x = edge;
+	}
+	ref = a_client->y + HEIGHT_B(a_client);
+	if (edge_next(EDGE_TOP, ref, -1, a_client, &edge) && ref -
+	    c_snap_margin < edge) {
+		a_client->y = edge - HEIGHT_B(a_client);
+	}
+	if (edge_next(EDGE_BOTTOM, a_client->y, 1, a_client, &edge) && edge <
+	    a_client->y + c_snap_margin) {
+		a_client->y = edge;
 	}
 	ref = VIEW_RIGHT(view) - WIDTH_B(a_client);
 	SNAP(<, ref, a_client->x, ref + c_snap_margin);
@@ -1200,18 +1987,96 @@ client_snap_position(struct Client *a_client)
 	SNAP(>, ref, a_client->y, ref - c_snap_margin);
 }
 
+/* Scales a 16-bit channel into a TrueColor mask. */
 uint32_t
-color_get(char const *a_name)
+color_channel(unsigned a_value, uint32_t a_mask)
+{
+	int shift, bits;
+
+	if (0 == a_mask) {
+		return 0;
+	}
+	for (shift = 0; !(1 & (a_mask >> shift)); ++shift)
+		;
+	for (bits = 0; 32 > shift + bits && (1 & (a_mask >> (shift +
+	    bits))); ++bits)
+		;
+	bits = MIN(bits, 16);
+	return (uint32_t)(a_value >> (16 - bits)) << shift & a_mask;
+}
+
+/*
+ * "#rgb" to "#rrrrggggbbbb" and "rgb:r/g/b" specs need no server on a
+ * TrueColor visual, only names have to be looked up.
+ */
+int
+color_parse(char const *a_name, uint32_t *a_pixel)
+{
+	unsigned rgb[3];
+	char const *p;
+	size_t i, len;
+
+	if (!g_visual || XCB_VISUAL_CLASS_TRUE_COLOR != g_visual->_class) {
+		return 0;
+	}
+	if ('#' == a_name[0]) {
+		len = strlen(a_name + 1) / 3;
+		if (0 == len || 4 < len || 3 * len != strlen(a_name + 1)) {
+			return 0;
+		}
+		for (i = 0; 3 > i; ++i) {
+			if (!hex_parse(a_name + 1 + i * len, len, &rgb[i])) {
+				return 0;
+			}
+			rgb[i] <<= 16 - 4 * len;
+		}
+	} else if (0 == strncmp(a_name, "rgb:", 4)) {
+		p = a_name + 4;
+		for (i = 0; 3 > i; ++i) {
+			for (len = 0; '\0' != p[len] && '/' != p[len]; ++len)
+				;
+			if (0 == len || 4 < len || (2 > i) != ('/' ==
+			    p[len]) || !hex_parse(p, len, &rgb[i])) {
+				return 0;
+			}
+			rgb[i] = (unsigned)(rgb[i] * 0xffffUL / ((1UL << 4 *
+			    len) - 1));
+			p += len + 1;
+		}
+	} else {
+		return 0;
+	}
+	*a_pixel = color_channel(rgb[0], g_visual->red_mask) |
+	    color_channel(rgb[1], g_visual->green_mask) |
+	    color_channel(rgb[2], g_visual->blue_mask);
+	return 1;
+}
+
+void
+color_reply(struct ColorRequest *a_req)
 {
 	xcb_alloc_named_color_reply_t *color;
-	uint32_t pixel;
 
-	color = xcb_alloc_named_color_reply(g_conn,
-	    xcb_alloc_named_color(g_conn, g_screen->default_colormap,
-	    strlen(a_name), a_name), NULL);
-	pixel = color->pixel;
+	if (a_req->is_local) {
+		return;
+	}
+	if (!(color = REPLY(xcb_alloc_named_color_reply(g_conn,
+	    a_req->cookie, NULL)))) {
+		errx(EXIT_FAILURE, "Could not allocate color '%s'.",
+		    a_req->name);
+	}
+	*a_req->pixel = color->pixel;
 	free(color);
-	return pixel;
+}
+
+void
+color_request(struct ColorRequest *a_req)
+{
+	if ((a_req->is_local = color_parse(a_req->name, a_req->pixel))) {
+		return;
+	}
+	a_req->cookie = xcb_alloc_named_color(g_conn,
+	    g_screen->default_colormap, strlen(a_req->name), a_req->name);
 }
 
 xcb_cursor_t
@@ -1225,154 +2090,490 @@ cursor_get(xcb_font_t a_font, int a_index)
 	return cursor;
 }
 
+/*
+ * Per workspace, the left, right, top and bottom edges of all clients are
+ * kept sorted so that snapping and jumping only need a binary search. The
+ * client remembers what it was indexed with.
+ */
 void
-event_button_press(xcb_button_press_event_t const *a_event)
+edge_insert(struct Client *a_client, size_t a_workspace)
 {
-	struct Arg arg;
-	struct ButtonBind const *bind;
-	struct Client *c;
-	enum Click click = CLICK_ROOT;
-	size_t i;
-
-	if (a_event->event == g_bar) {
-		struct View const *view;
-		int x = 0;
+	struct EdgeIndex *index = &g_edge_index[a_workspace];
+	size_t i, type;
 
-		view = view_find(a_event->root_x, a_event->root_y);
-		i = 0;
-		do {
-			x += text_width(&g_workspace_label[i]);
-		} while (x <= a_event->root_x && LENGTH(c_workspace_label) > ++i);
-		if (LENGTH(c_workspace_label) > i) {
-			click = CLICK_WORKSPACE;
-			arg.i = i;
-		} else if (VIEW_RIGHT(view) - text_width(&g_root_name) <=
-		    a_event->root_x) {
-			click = CLICK_STATUS;
+	if (index->num == index->cap) {
+		index->cap = index->cap ? 2 * index->cap : 16;
+		for (type = 0; EDGE_NUM > type; ++type) {
+			REALLOC(index->edge[type], index->cap);
 		}
-	} else if ((c = client_get(a_event->event, NULL))) {
-		click = CLICK_CLIENT;
-		client_focus(c, 1, 1, 0);
 	}
-	g_button_press_window = a_event->event;
-	g_button_press_x = a_event->root_x;
-	g_button_press_y = a_event->root_y;
-	for (i = 0, bind = c_button_bind; LENGTH(c_button_bind) > i; ++i,
-	    ++bind) {
-		if (bind->click == click && bind->code == a_event->detail &&
-		    bind->state == a_event->state) {
-			bind->action(&arg);
-		}
+	a_client->edge[EDGE_LEFT] = a_client->x;
+	a_client->edge[EDGE_RIGHT] = a_client->x + WIDTH_B(a_client);
+	a_client->edge[EDGE_TOP] = a_client->y;
+	a_client->edge[EDGE_BOTTOM] = a_client->y + HEIGHT_B(a_client);
+	for (type = 0; EDGE_NUM > type; ++type) {
+		struct Edge *edge = index->edge[type];
+
+		i = edge_lower(edge, index->num, a_client->edge[type]);
+		memmove(&edge[i + 1], &edge[i], (index->num - i) * sizeof
+		    *edge);
+		edge[i].value = a_client->edge[type];
+		edge[i].client = a_client;
 	}
+	++index->num;
 }
 
-void
-event_configure_notify(xcb_configure_notify_event_t const *a_event)
+/* First index with a value not less than the given one. */
+size_t
+edge_lower(struct Edge const *a_edge, size_t a_num, int a_value)
 {
-	struct Client *c;
+	size_t lo = 0, hi = a_num;
 
-	c = client_get(a_event->window, NULL);
-	if (!c && !a_event->override_redirect) {
-		c = client_add(a_event->window, XCB_WINDOW_NONE);
-	} else if (c && a_event->override_redirect) {
-		client_free(&c);
+	while (lo < hi) {
+		size_t mid = (lo + hi) / 2;
+
+		if (a_edge[mid].value < a_value) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
 	}
+	return lo;
 }
 
-void
-event_configure_request(xcb_configure_request_event_t const *a_event)
+/*
+ * Nearest edge of the given type on the current workspace strictly after
+ * (dir > 0) or before (dir < 0) the value, ignoring the given client.
+ */
+int
+edge_next(enum EdgeType a_type, int a_value, int a_dir, struct Client
+    const *a_exclude, int *a_edge)
 {
-	struct Client *c;
+	struct EdgeIndex const *index = &g_edge_index[g_workspace_cur];
+	struct Edge const *edge = index->edge[a_type];
+	size_t i;
 
-	if ((c = client_get(a_event->window, NULL))) {
-		if (XCB_CONFIG_WINDOW_WIDTH & a_event->value_mask) {
-			c->width = a_event->width;
-		}
-		if (XCB_CONFIG_WINDOW_HEIGHT & a_event->value_mask) {
-			c->height = a_event->height;
-		}
-		if ((XCB_CONFIG_WINDOW_WIDTH | XCB_CONFIG_WINDOW_HEIGHT) &
-		    a_event->value_mask) {
-			client_resize(c, 0);
+	if (0 < a_dir) {
+		for (i = edge_lower(edge, index->num, a_value + 1); index->num
+		    > i && a_exclude == edge[i].client; ++i)
+			;
+		if (index->num == i) {
+			return 0;
 		}
 	} else {
-		uint32_t *p;
-		uint16_t mask;
-
-		p = g_values;
-		mask = (XCB_CONFIG_WINDOW_X | XCB_CONFIG_WINDOW_Y |
-		    XCB_CONFIG_WINDOW_WIDTH | XCB_CONFIG_WINDOW_HEIGHT) &
-		    a_event->value_mask;
-		if (XCB_CONFIG_WINDOW_X & mask) {
-			*p++ = a_event->x;
-		}
-		if (XCB_CONFIG_WINDOW_Y & mask) {
-			*p++ = MAX(a_event->y, g_font_height);
-		}
-		if (XCB_CONFIG_WINDOW_WIDTH & mask) {
-			*p++ = a_event->width;
+		for (i = edge_lower(edge, index->num, a_value); 0 < i &&
+		    a_exclude == edge[i - 1].client; --i)
+			;
+		if (0 == i--) {
+			return 0;
 		}
-		if (XCB_CONFIG_WINDOW_HEIGHT & mask) {
-			*p++ = a_event->height;
-		}
-		xcb_configure_window(g_conn, a_event->window, mask, g_values);
 	}
+	*a_edge = edge[i].value;
+	return 1;
 }
 
 void
-event_destroy_notify(xcb_destroy_notify_event_t const *a_event)
+edge_remove(struct Client const *a_client, size_t a_workspace)
 {
-	struct Client *c;
-
-	c = client_get(a_event->window, NULL);
-	client_free(&c);
+	struct EdgeIndex *index = &g_edge_index[a_workspace];
+	size_t i, type;
+
+	for (type = 0; EDGE_NUM > type; ++type) {
+		struct Edge *edge = index->edge[type];
+
+		for (i = edge_lower(edge, index->num, a_client->edge[type]);
+		    index->num > i && a_client != edge[i].client; ++i)
+			;
+		assert(index->num > i);
+		memmove(&edge[i], &edge[i + 1], (index->num - i - 1) * sizeof
+		    *edge);
+	}
+	--index->num;
 }
 
 void
-event_enter_notify(xcb_enter_notify_event_t const *a_event)
+edge_update(struct Client *a_client)
 {
-	struct Client *c;
-	size_t workspace;
+	struct ClientSlot const *slot;
 
-	if ((c = client_get(a_event->event, &workspace)) &&
-	    g_workspace_cur == workspace) {
-		client_focus(c, 1, 0, 0);
+	if (!(slot = client_slot_find(a_client->window)) || a_client !=
+	    slot->client) {
+		return;
+	}
+	if (a_client->edge[EDGE_LEFT] == a_client->x &&
+	    a_client->edge[EDGE_RIGHT] == a_client->x + WIDTH_B(a_client) &&
+	    a_client->edge[EDGE_TOP] == a_client->y &&
+	    a_client->edge[EDGE_BOTTOM] == a_client->y + HEIGHT_B(a_client)) {
+		return;
 	}
+	edge_remove(a_client, slot->workspace);
+	edge_insert(a_client, slot->workspace);
 }
 
+/*
+ * Modal pointer drag of the focused client. All queued motion is drained
+ * before the latest position is applied, and configures are capped to
+ * c_drag_rate, or the refresh rate of the output, until the button is
+ * released which applies the exact final position.
+ */
 void
-event_expose(xcb_expose_event_t const *a_event)
+drag(xcb_cursor_t a_cursor, void (*a_apply)(int, int), enum Probe a_probe)
 {
-	if (0 == a_event->count && a_event->window == g_bar) {
-		g_do_bar_redraw = 1;
-	}
-}
+	struct pollfd fds;
+	double period, time_prev, t0 = 0;
+	int do_drag, is_pending, x = 0, y = 0;
+
+	if (0 < c_drag_rate) {
+		period = 1e3 / c_drag_rate;
+	} else {
+		struct View const *view;
+
+		view = view_find(g_focus->x, g_focus->y);
+		period = 1e3 / (0 < view->rate ? view->rate : 60);
+	}
+	xcb_grab_pointer(g_conn, 0, g_focus->window,
+	    XCB_EVENT_MASK_BUTTON_RELEASE | XCB_EVENT_MASK_POINTER_MOTION,
+	    XCB_GRAB_MODE_ASYNC, XCB_GRAB_MODE_ASYNC, XCB_NONE, a_cursor,
+	    XCB_CURRENT_TIME);
+	xcb_flush(g_conn);
+	fds.fd = xcb_get_file_descriptor(g_conn);
+	fds.events = POLLIN;
+	time_prev = 0;
+	for (do_drag = 1, is_pending = 0; do_drag;) {
+		xcb_generic_event_t *event;
+		xcb_motion_notify_event_t const *motion;
+
+		if (!(event = event_poll())) {
+			double dt;
+
+			if (xcb_connection_has_error(g_conn)) {
+				break;
+			}
+			if (!is_pending) {
+				poll(&fds, 1, g_trace_is_replay ? 0 : -1);
+				continue;
+			}
+			dt = time_get() - time_prev;
+			if (period > dt) {
+				poll(&fds, 1, (int)(period - dt) + 1);
+				continue;
+			}
+			a_apply(x, y);
+			txn_commit();
+			xcb_flush(g_conn);
+			histogram_add(&g_hist_probe[a_probe], t0);
+			time_prev = time_get();
+			is_pending = 0;
+			continue;
+		}
+		/* Release and motion events share the pointer fields. */
+		motion = (void const *)event;
+		switch (XCB_EVENT_RESPONSE_TYPE(event)) {
+		case XCB_BUTTON_RELEASE:
+			g_pointer_x = motion->root_x;
+			g_pointer_y = motion->root_y;
+			a_apply(g_pointer_x, g_pointer_y);
+			do_drag = 0;
+			break;
+		case XCB_MOTION_NOTIFY:
+			g_pointer_x = x = motion->root_x;
+			g_pointer_y = y = motion->root_y;
+			/* Latency counts from the oldest motion not applied. */
+			if (!is_pending) {
+				t0 = time_get();
+			}
+			is_pending = 1;
+			break;
+		case XCB_EXPOSE:
+			/* FALLTHROUGH */
+		case XCB_MAP_REQUEST:
+			/* FALLTHROUGH */
+		case XCB_CONFIGURE_REQUEST:
+			event_handle(event);
+			break;
+		}
+		free(event);
+	}
+	xcb_ungrab_pointer(g_conn, XCB_CURRENT_TIME);
+}
+
+void
+drag_move(int a_x, int a_y)
+{
+	g_focus->x = a_x + g_drag_dx;
+	g_focus->y = a_y + g_drag_dy;
+	client_snap_position(g_focus);
+	client_move(g_focus, VISIBLE);
+}
+
+void
+drag_resize(int a_x, int a_y)
+{
+	g_focus->width = a_x + g_drag_dx;
+	g_focus->height = a_y + g_drag_dy;
+	client_snap_dimension(g_focus);
+	client_resize(g_focus, 1);
+}
+
+/*
+ * Drains the event queue in batches. Only the last PropertyNotify per
+ * window and atom and the last ConfigureNotify per window in a batch are
+ * handled, since the handlers only look at the latest state anyway.
+ */
+void
+event_batch()
+{
+	static xcb_generic_event_t *s_batch[256];
+
+	for (;;) {
+		xcb_generic_event_t *ev;
+		size_t i, j, num;
+
+		for (num = 0; LENGTH(s_batch) > num && (ev = event_poll());
+		    ++num) {
+			s_batch[num] = ev;
+		}
+		if (0 == num) {
+			break;
+		}
+		for (i = 0; num > i; ++i) {
+			uint8_t const c_type = XCB_EVENT_RESPONSE_TYPE(
+			    s_batch[i]);
+
+			if (XCB_PROPERTY_NOTIFY != c_type &&
+			    XCB_CONFIGURE_NOTIFY != c_type) {
+				continue;
+			}
+			for (j = i + 1; num > j; ++j) {
+				if (!s_batch[j] || c_type !=
+				    XCB_EVENT_RESPONSE_TYPE(s_batch[j])) {
+					continue;
+				}
+				if (XCB_PROPERTY_NOTIFY == c_type) {
+					xcb_property_notify_event_t const
+					    *p0, *p1;
+
+					p0 = (void const *)s_batch[i];
+					p1 = (void const *)s_batch[j];
+					if (p0->window == p1->window &&
+					    p0->atom == p1->atom) {
+						break;
+					}
+				} else {
+					xcb_configure_notify_event_t const
+					    *c0, *c1;
+
+					c0 = (void const *)s_batch[i];
+					c1 = (void const *)s_batch[j];
+					if (c0->window == c1->window) {
+						break;
+					}
+				}
+			}
+			if (num > j) {
+				FREE(s_batch[i]);
+				++g_stat_coalesced_num;
+			}
+		}
+		for (i = 0; num > i; ++i) {
+			if (s_batch[i]) {
+				event_handle(s_batch[i]);
+				FREE(s_batch[i]);
+				++g_stat_event_num;
+			}
+		}
+		++g_stat_batch_num;
+		ewmh_flush();
+		txn_commit();
+		xcb_flush(g_conn);
+	}
+}
+
+void
+event_button_press(xcb_button_press_event_t const *a_event)
+{
+	struct Arg arg;
+	struct ButtonBind const *bind;
+	struct View const *view;
+	struct Client *c;
+	enum Click click = CLICK_ROOT;
+	size_t i;
+
+	if ((view = view_find_bar(a_event->event))) {
+		int x = 0;
+
+		i = 0;
+		do {
+			x += text_width(&g_workspace_label[i]);
+		} while (x <= a_event->event_x && LENGTH(c_workspace_label) >
+		    ++i);
+		if (LENGTH(c_workspace_label) > i) {
+			click = CLICK_WORKSPACE;
+			arg.i = i;
+		} else if (view->width - view->status_width <=
+		    a_event->event_x) {
+			click = CLICK_STATUS;
+		}
+	} else if ((c = client_get(a_event->event, NULL))) {
+		click = CLICK_CLIENT;
+		client_focus(c, 1, 1, 0);
+	}
+	g_button_press_window = a_event->event;
+	g_pointer_x = g_button_press_x = a_event->root_x;
+	g_pointer_y = g_button_press_y = a_event->root_y;
+	for (i = 0, bind = c_button_bind; LENGTH(c_button_bind) > i; ++i,
+	    ++bind) {
+		if (bind->click == click && bind->code == a_event->detail &&
+		    bind->state == a_event->state) {
+			action_run(bind->action, &arg);
+		}
+	}
+}
+
+void
+event_configure_notify(xcb_configure_notify_event_t const *a_event)
+{
+	struct Client *c;
+
+	c = client_get(a_event->window, NULL);
+	if (!c && !a_event->override_redirect) {
+		c = client_add(a_event->window, XCB_WINDOW_NONE);
+	} else if (c && a_event->override_redirect) {
+		client_free(&c);
+	}
+}
+
+void
+event_configure_request(xcb_configure_request_event_t const *a_event)
+{
+	struct Client *c;
+
+	if ((c = client_get(a_event->window, NULL))) {
+		/* The client waits for a ConfigureNotify either way. */
+		c->sent.width = -1;
+		txn_touch(c);
+		if (XCB_CONFIG_WINDOW_WIDTH & a_event->value_mask) {
+			c->width = a_event->width;
+		}
+		if (XCB_CONFIG_WINDOW_HEIGHT & a_event->value_mask) {
+			c->height = a_event->height;
+		}
+		if ((XCB_CONFIG_WINDOW_WIDTH | XCB_CONFIG_WINDOW_HEIGHT) &
+		    a_event->value_mask) {
+			client_resize(c, 0);
+		}
+	} else {
+		uint32_t *p;
+		uint16_t mask;
+
+		p = g_values;
+		mask = (XCB_CONFIG_WINDOW_X | XCB_CONFIG_WINDOW_Y |
+		    XCB_CONFIG_WINDOW_WIDTH | XCB_CONFIG_WINDOW_HEIGHT) &
+		    a_event->value_mask;
+		if (XCB_CONFIG_WINDOW_X & mask) {
+			*p++ = a_event->x;
+		}
+		if (XCB_CONFIG_WINDOW_Y & mask) {
+			*p++ = MAX(a_event->y, g_font_height);
+		}
+		if (XCB_CONFIG_WINDOW_WIDTH & mask) {
+			*p++ = a_event->width;
+		}
+		if (XCB_CONFIG_WINDOW_HEIGHT & mask) {
+			*p++ = a_event->height;
+		}
+		xcb_configure_window(g_conn, a_event->window, mask, g_values);
+	}
+}
+
+void
+event_destroy_notify(xcb_destroy_notify_event_t const *a_event)
+{
+	struct Client *c;
+
+	c = client_get(a_event->window, NULL);
+	client_free(&c);
+}
+
+void
+event_enter_notify(xcb_enter_notify_event_t const *a_event)
+{
+	struct Client *c;
+	size_t workspace;
+
+	g_pointer_x = a_event->root_x;
+	g_pointer_y = a_event->root_y;
+	if ((c = client_get(a_event->event, &workspace)) &&
+	    g_workspace_cur == workspace) {
+		client_focus(c, 1, 0, 0);
+	}
+}
+
+void
+event_expose(xcb_expose_event_t const *a_event)
+{
+	struct View const *view;
+
+	if ((view = view_find_bar(a_event->window)) && !view->is_bar_reset) {
+		xcb_copy_area(g_conn, view->pixmap, view->bar,
+		    g_gc_fill[SCHEME_NORMAL], a_event->x, a_event->y,
+		    a_event->x, a_event->y, a_event->width, a_event->height);
+	}
+}
 
 void
 event_handle(xcb_generic_event_t const *a_event)
 {
 	uint8_t const c_i = XCB_EVENT_RESPONSE_TYPE(a_event);
-
+	double const c_t0 = time_get();
+	struct Audit *audit_prev;
+	int type_prev;
+
+	/* Events handled inside modal actions are billed to themselves. */
+	audit_prev = g_audit_cur;
+	type_prev = g_audit_event_type;
+	g_audit_cur = NULL;
+	g_audit_event_type = c_i;
 	if (c_i == g_randr_evbase + XCB_RANDR_SCREEN_CHANGE_NOTIFY) {
-		randr_update();
+		/*
+		 * Docking sends a burst, only look once it has settled.
+		 * Traces are replayed by order, not by the clock.
+		 */
+		if (g_trace) {
+			randr_flush();
+		} else {
+			timer_add(c_randr_delay, randr_flush);
+		}
 	} else if (LENGTH(g_event_handler) > c_i && g_event_handler[c_i]) {
 		g_event_handler[c_i](a_event);
 	}
+	g_audit_cur = audit_prev;
+	g_audit_event_type = type_prev;
+	histogram_add(&g_hist_event[c_i], c_t0);
 }
 
 void
 event_key_press(xcb_key_press_event_t const *a_event)
 {
-	xcb_keysym_t keysym;
 	struct KeyBind const *bind;
-	size_t i;
+	unsigned i;
+
+	g_pointer_x = a_event->root_x;
+	g_pointer_y = a_event->root_y;
+	i = g_key_dispatch[a_event->detail][a_event->state &
+	    ~g_key_lock_mask & 0xff];
+	if (0 != i) {
+		bind = &c_key_bind[i - 1];
+		action_run(bind->action, &bind->arg);
+	}
+}
 
-	keysym = xcb_key_symbols_get_keysym(g_key_symbols, a_event->detail,
-	    0);
-	for (i = 0, bind = c_key_bind; LENGTH(c_key_bind) > i; ++i, ++bind) {
-		if (bind->keysym == keysym && bind->state == a_event->state) {
-			bind->action(&bind->arg);
-		}
+/* Anything mapped, e.g. a menu, may end up above the top client. */
+void
+event_map_notify(xcb_map_notify_event_t const *a_event)
+{
+	if (g_txn_top != a_event->window) {
+		g_txn_top = XCB_NONE;
 	}
 }
 
@@ -1381,6 +2582,7 @@ event_map_request(xcb_map_request_event_t const *a_event)
 {
 	struct Client *c;
 
+	g_txn_top = XCB_NONE;
 	xcb_map_window(g_conn, a_event->window);
 	if (!(c = client_get(a_event->window, NULL))) {
 		c = client_add(a_event->window, a_event->parent);
@@ -1388,6 +2590,37 @@ event_map_request(xcb_map_request_event_t const *a_event)
 	client_focus(c, 1, 1, 0);
 }
 
+void
+event_mapping_notify(xcb_mapping_notify_event_t const *a_event)
+{
+	xcb_refresh_keyboard_mapping(g_key_symbols,
+	    (xcb_mapping_notify_event_t *)a_event);
+	if (XCB_MAPPING_POINTER != a_event->request) {
+		key_grab(xcb_get_modifier_mapping(g_conn));
+	}
+}
+
+/* All events go through here and event_wait so they can be traced. */
+xcb_generic_event_t *
+event_poll()
+{
+	xcb_generic_event_t *event;
+
+	if (g_trace_is_replay) {
+		/* The live server only has errors for us. */
+		while ((event = xcb_poll_for_event(g_conn))) {
+			free(event);
+		}
+		return trace_event();
+	}
+	event = xcb_poll_for_event(g_conn);
+	if (g_trace) {
+		trace_write(event ? TRACE_EVENT : TRACE_NONE, event, event ?
+		    32 : 0);
+	}
+	return event;
+}
+
 void
 event_property_notify(xcb_property_notify_event_t const *a_event)
 {
@@ -1397,227 +2630,1886 @@ event_property_notify(xcb_property_notify_event_t const *a_event)
 			g_do_bar_redraw = 1;
 		}
 	} else {
+		xcb_get_property_reply_t *reply;
 		struct Client *c;
+		size_t workspace;
 
-		if ((c = client_get(a_event->window, NULL))) {
+		if ((c = client_get(a_event->window, &workspace))) {
 			if (XCB_ATOM_WM_HINTS == a_event->atom) {
-				xcb_icccm_wm_hints_t hints;
-
-				if (xcb_icccm_get_wm_hints_reply(g_conn,
+				if ((reply = REPLY_PROPERTY(
 				    xcb_icccm_get_wm_hints(g_conn,
-				    a_event->window), &hints, NULL)) {
-					if ((XCB_ICCCM_WM_HINT_X_URGENCY &
-					    hints.flags) && g_focus != c) {
-						c->is_urgent = 1;
-						g_do_bar_redraw = 1;
+				    a_event->window)))) {
+					if (!xcb_icccm_get_wm_hints_from_reply(
+					    &c->wm_hints, reply)) {
+						c->wm_hints.flags = 0;
 					}
+					free(reply);
+				}
+				if ((XCB_ICCCM_WM_HINT_X_URGENCY &
+				    c->wm_hints.flags) && g_focus != c) {
+					c->is_urgent = 1;
+					g_do_bar_redraw = 1;
 				}
 			} else if (XCB_ATOM_WM_NORMAL_HINTS == a_event->atom) {
-				xcb_icccm_get_wm_normal_hints_reply(g_conn,
+				if ((reply = REPLY_PROPERTY(
 				    xcb_icccm_get_wm_normal_hints(g_conn,
-				    c->window), &c->hints, NULL);
+				    c->window)))) {
+					xcb_icccm_get_wm_size_hints_from_reply(
+					    &c->hints, reply);
+					free(reply);
+				}
 			} else if (g_NET_WM_NAME == a_event->atom ||
 			    XCB_ATOM_WM_NAME == a_event->atom) {
-				client_name_update(c);
-				g_do_bar_redraw = 1;
+				c->is_name_dirty = 1;
+				g_has_name_dirty |= g_workspace_cur ==
+				    workspace;
 			}
 		}
 	}
 }
 
-void
-event_unmap_notify(xcb_unmap_notify_event_t const *a_event)
+void
+event_unmap_notify(xcb_unmap_notify_event_t const *a_event)
+{
+	struct Client *c;
+
+	c = client_get(a_event->window, NULL);
+	client_free(&c);
+}
+
+void
+ewmh_client_add(xcb_window_t a_window, size_t a_workspace)
+{
+	if (g_ewmh_client_cap == g_ewmh_client_num) {
+		g_ewmh_client_cap = MAX(16, 2 * g_ewmh_client_cap);
+		REALLOC(g_ewmh_client, g_ewmh_client_cap);
+	}
+	g_ewmh_client[g_ewmh_client_num++] = a_window;
+	ewmh_desktop_set(a_window, a_workspace);
+}
+
+void
+ewmh_client_remove(xcb_window_t a_window)
+{
+	size_t i;
+
+	for (i = 0; g_ewmh_client_num > i && a_window != g_ewmh_client[i];
+	    ++i)
+		;
+	if (g_ewmh_client_num == i) {
+		return;
+	}
+	memmove(g_ewmh_client + i, g_ewmh_client + i + 1,
+	    (--g_ewmh_client_num - i) * sizeof *g_ewmh_client);
+	g_ewmh_do_replace = 1;
+}
+
+void
+ewmh_desktop_set(xcb_window_t a_window, size_t a_workspace)
+{
+	uint32_t desktop = a_workspace;
+
+	xcb_change_property(g_conn, XCB_PROP_MODE_REPLACE, a_window,
+	    g_NET_WM_DESKTOP, XCB_ATOM_CARDINAL, 32, 1, &desktop);
+}
+
+/*
+ * Publishes what changed since the last event batch. New clients are
+ * appended to the list, only removals rewrite it.
+ */
+void
+ewmh_flush()
+{
+	xcb_window_t active;
+
+	if (g_ewmh_do_replace) {
+		xcb_change_property(g_conn, XCB_PROP_MODE_REPLACE, g_root,
+		    g_NET_CLIENT_LIST, XCB_ATOM_WINDOW, 32, g_ewmh_client_num,
+		    g_ewmh_client);
+		g_ewmh_do_replace = 0;
+	} else if (g_ewmh_client_num > g_ewmh_client_sent) {
+		xcb_change_property(g_conn, XCB_PROP_MODE_APPEND, g_root,
+		    g_NET_CLIENT_LIST, XCB_ATOM_WINDOW, 32, g_ewmh_client_num
+		    - g_ewmh_client_sent, g_ewmh_client + g_ewmh_client_sent);
+	}
+	g_ewmh_client_sent = g_ewmh_client_num;
+	active = g_focus ? g_focus->window : (xcb_window_t)XCB_NONE;
+	if (g_ewmh_active != active) {
+		g_ewmh_active = active;
+		xcb_change_property(g_conn, XCB_PROP_MODE_REPLACE, g_root,
+		    g_NET_ACTIVE_WINDOW, XCB_ATOM_WINDOW, 32, 1, &active);
+	}
+	if (g_ewmh_desktop != g_workspace_cur) {
+		uint32_t desktop = g_workspace_cur;
+
+		g_ewmh_desktop = g_workspace_cur;
+		xcb_change_property(g_conn, XCB_PROP_MODE_REPLACE, g_root,
+		    g_NET_CURRENT_DESKTOP, XCB_ATOM_CARDINAL, 32, 1,
+		    &desktop);
+	}
+}
+
+xcb_generic_event_t *
+event_wait()
+{
+	xcb_generic_event_t *event;
+
+	if (g_trace_is_replay) {
+		while (!(event = event_poll()))
+			;
+		return event;
+	}
+	event = xcb_wait_for_event(g_conn);
+	if (g_trace && event) {
+		trace_write(TRACE_EVENT, event, 32);
+	}
+	return event;
+}
+
+/* Biggest first, then top-left first, like furnishing always has. */
+int
+furnish_cmp(void const *a_l, void const *a_r)
+{
+	struct Client const *l = *(struct Client * const *)a_l;
+	struct Client const *r = *(struct Client * const *)a_r;
+	int const c_l_size = l->width * l->height;
+	int const c_r_size = r->width * r->height;
+	int const c_l_ofs = l->x + 10000 * l->y;
+	int const c_r_ofs = r->x + 10000 * r->y;
+
+	if (c_l_size != c_r_size) {
+		return c_l_size > c_r_size ? -1 : 1;
+	}
+	return c_l_ofs < c_r_ofs ? -1 : c_l_ofs > c_r_ofs;
+}
+
+/*
+ * Width of a glyph from the font's char infos, -1 if it does not exist so
+ * that the caller can fall back on the default char like the server does.
+ */
+int
+glyph_width(unsigned a_byte1, unsigned a_byte2)
+{
+	xcb_charinfo_t const *ci;
+	unsigned cols;
+
+	if (0 == xcb_query_font_char_infos_length(g_font_info)) {
+		return g_font_info->max_bounds.character_width;
+	}
+	if (g_font_info->min_byte1 > a_byte1 || g_font_info->max_byte1 <
+	    a_byte1 || g_font_info->min_char_or_byte2 > a_byte2 ||
+	    g_font_info->max_char_or_byte2 < a_byte2) {
+		return -1;
+	}
+	cols = g_font_info->max_char_or_byte2 -
+	    g_font_info->min_char_or_byte2 + 1;
+	ci = xcb_query_font_char_infos(g_font_info) + (a_byte1 -
+	    g_font_info->min_byte1) * cols + a_byte2 -
+	    g_font_info->min_char_or_byte2;
+	if (0 == ci->left_side_bearing && 0 == ci->right_side_bearing &&
+	    0 == ci->character_width && 0 == ci->ascent && 0 == ci->descent
+	    && 0 == ci->attributes) {
+		return -1;
+	}
+	return ci->character_width;
+}
+
+int
+hex_parse(char const *a_str, size_t a_len, unsigned *a_value)
+{
+	size_t i;
+
+	*a_value = 0;
+	for (i = 0; a_len > i; ++i) {
+		int const c_c = a_str[i];
+
+		*a_value <<= 4;
+		if ('0' <= c_c && '9' >= c_c) {
+			*a_value |= c_c - '0';
+		} else if ('a' <= c_c && 'f' >= c_c) {
+			*a_value |= c_c - 'a' + 10;
+		} else if ('A' <= c_c && 'F' >= c_c) {
+			*a_value |= c_c - 'A' + 10;
+		} else {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+void
+histogram_add(struct Histogram *a_hist, double a_t0)
+{
+	double dt;
+	unsigned long us;
+	size_t i;
+
+	dt = 1e3 * (time_get() - a_t0);
+	us = 0 < dt ? (unsigned long)dt : 0;
+	for (i = 0; HISTOGRAM_NUM - 1 > i && us >> (i + 1); ++i)
+		;
+	++a_hist->bucket[i];
+	++a_hist->num;
+	a_hist->sum += us;
+}
+
+/* One line per histogram, buckets labelled with their lower bound. */
+void
+histogram_print(FILE *a_file, char const *a_name, struct Histogram const
+    *a_hist)
+{
+	size_t i, first, last;
+
+	if (0 == a_hist->num) {
+		return;
+	}
+	for (first = 0; 0 == a_hist->bucket[first]; ++first)
+		;
+	for (last = HISTOGRAM_NUM - 1; 0 == a_hist->bucket[last]; --last)
+		;
+	fprintf(a_file, "%-12s n=%lu avg=%.0fus", a_name, a_hist->num,
+	    a_hist->sum / a_hist->num);
+	for (i = first; last >= i; ++i) {
+		fprintf(a_file, " %lu:%lu", 0 == i ? 0 : 1UL << i,
+		    a_hist->bucket[i]);
+	}
+	fprintf(a_file, "\n");
+}
+
+int
+int_cmp(void const *a_l, void const *a_r)
+{
+	int const l = *(int const *)a_l;
+	int const r = *(int const *)a_r;
+
+	return l < r ? -1 : l > r;
+}
+
+/*
+ * Grabs every binding also with the lock modifiers, NumLock wherever it is
+ * mapped, and rebuilds the dispatch table.
+ */
+void
+key_grab(xcb_get_modifier_mapping_cookie_t a_cookie)
+{
+	xcb_get_modifier_mapping_reply_t *reply;
+	struct KeyBind const *bind;
+	xcb_keycode_t *num_lock, *k;
+	size_t i;
+
+	if (LENGTH(g_key_dispatch[0]) <= LENGTH(c_key_bind)) {
+		errx(EXIT_FAILURE, "Too many key bindings.");
+	}
+	g_key_lock_mask = XCB_MOD_MASK_LOCK;
+	num_lock = xcb_key_symbols_get_keycode(g_key_symbols, XK_Num_Lock);
+	if ((reply = REPLY(xcb_get_modifier_mapping_reply(g_conn, a_cookie,
+	    NULL)))) {
+		xcb_keycode_t const *keycode;
+		size_t per;
+
+		keycode = xcb_get_modifier_mapping_keycodes(reply);
+		per = reply->keycodes_per_modifier;
+		for (i = 0; 8 * per > i; ++i) {
+			for (k = num_lock; k && XCB_NO_SYMBOL != *k; ++k) {
+				if (*k == keycode[i]) {
+					g_key_lock_mask |= 1 << (i / per);
+				}
+			}
+		}
+		free(reply);
+	}
+	free(num_lock);
+
+	xcb_ungrab_key(g_conn, XCB_GRAB_ANY, g_root, XCB_MOD_MASK_ANY);
+	memset(g_key_dispatch, 0, sizeof g_key_dispatch);
+	for (i = 0, bind = c_key_bind; LENGTH(c_key_bind) > i; ++i, ++bind) {
+		xcb_keycode_t *keycode_list;
+
+		keycode_list = xcb_key_symbols_get_keycode(g_key_symbols,
+		    bind->keysym);
+		for (k = keycode_list; k && XCB_NO_SYMBOL != *k; ++k) {
+			uint8_t *slot;
+			unsigned lock;
+
+			slot = &g_key_dispatch[*k][bind->state & 0xff];
+			if (0 != *slot) {
+				continue;
+			}
+			*slot = i + 1;
+			for (lock = 0; 0xff >= lock; ++lock) {
+				if (lock != (lock & g_key_lock_mask)) {
+					continue;
+				}
+				xcb_grab_key(g_conn, 1, g_root, bind->state |
+				    lock, *k, XCB_GRAB_MODE_ASYNC,
+				    XCB_GRAB_MODE_ASYNC);
+			}
+		}
+		free(keycode_list);
+	}
+}
+
+void
+my_exit()
+{
+	size_t i;
+
+	for (i = 0; LENGTH(c_workspace_label) > i; ++i) {
+		while (!TAILQ_EMPTY(&g_client_list[i])) {
+			struct Client *c;
+
+			c = TAILQ_FIRST(&g_client_list[i]);
+			client_free(&c);
+		}
+	}
+	FREE(g_client_slot);
+	FREE(g_timer);
+	FREE(g_txn_window);
+	FREE(g_ewmh_client);
+	FREE(g_status);
+	if (g_edge_index) {
+		for (i = 0; LENGTH(c_workspace_label) > i; ++i) {
+			size_t type;
+
+			for (type = 0; EDGE_NUM > type; ++type) {
+				free(g_edge_index[i].edge[type]);
+			}
+		}
+		FREE(g_edge_index);
+	}
+	view_clear();
+	if (g_trace) {
+		fclose(g_trace);
+	}
+	if (g_conn) {
+		xcb_flush(g_conn);
+		xcb_disconnect(g_conn);
+	}
+	FREE(g_workspace_label);
+	FREE(g_font_info);
+	FREE(g_span);
+	FREE(g_place.xs);
+	FREE(g_place.ys);
+	FREE(g_place.tx);
+	FREE(g_place.ty);
+	FREE(g_place.tx_cell0);
+	FREE(g_place.tx_cell1);
+	FREE(g_skyline);
+	FREE(g_skyline_tmp);
+	FREE(g_place.delta);
+	FREE(g_place.cell);
+	FREE(g_audit_site);
+}
+
+/*
+ * Sibling overlap with [x0,x1) x [y,y+height), given the grid cells of the
+ * edges.
+ */
+double
+place_area(int a_x0, size_t a_x0_cell, int a_x1, size_t a_x1_cell, int a_y,
+    size_t a_y0_cell, size_t a_y1_cell)
+{
+	int const c_y1 = a_y + g_place.height_b;
+
+	return place_integral(a_x1, a_x1_cell, c_y1, a_y1_cell) -
+	    place_integral(a_x0, a_x0_cell, c_y1, a_y1_cell) -
+	    place_integral(a_x1, a_x1_cell, a_y, a_y0_cell) +
+	    place_integral(a_x0, a_x0_cell, a_y, a_y0_cell);
+}
+
+/*
+ * Prepares placement of a client among its siblings on the current
+ * workspace: the sorted candidate edges, and a coverage grid over the
+ * compressed sibling edges with prefix integrals so that the overlap with
+ * any rectangle is exact and costs four lookups.
+ */
+void
+place_build(struct Client const *a_client, size_t a_workspace)
+{
+	struct Place *p = &g_place;
+	struct Client const *sibling;
+	size_t i, j, n, mx, my;
+
+	n = 0;
+	TAILQ_FOREACH(sibling, &g_client_list[a_workspace], next) {
+		++n;
+	}
+	REALLOC(p->xs, 2 * n + 1);
+	REALLOC(p->ys, 2 * n + 1);
+	REALLOC(p->tx, 4 * n + 1);
+	REALLOC(p->ty, 4 * n + 1);
+	REALLOC(p->tx_cell0, 4 * n + 1);
+	REALLOC(p->tx_cell1, 4 * n + 1);
+	p->width_b = WIDTH_B(a_client);
+	p->height_b = HEIGHT_B(a_client);
+
+	p->mx = p->my = p->tx_num = p->ty_num = 0;
+	TAILQ_FOREACH(sibling, &g_client_list[a_workspace], next) {
+		if (sibling == a_client) {
+			continue;
+		}
+		p->xs[p->mx++] = sibling->x;
+		p->xs[p->mx++] = sibling->x + WIDTH_B(sibling);
+		p->ys[p->my++] = sibling->y;
+		p->ys[p->my++] = sibling->y + HEIGHT_B(sibling);
+		p->tx[p->tx_num++] = sibling->x - WIDTH_B(a_client);
+		p->tx[p->tx_num++] = sibling->x;
+		p->tx[p->tx_num++] = sibling->x + WIDTH_B(sibling) -
+		    WIDTH_B(a_client);
+		p->tx[p->tx_num++] = sibling->x + WIDTH_B(sibling);
+		p->ty[p->ty_num++] = sibling->y - HEIGHT_B(a_client);
+		p->ty[p->ty_num++] = sibling->y;
+		p->ty[p->ty_num++] = sibling->y + HEIGHT_B(sibling) -
+		    HEIGHT_B(a_client);
+		p->ty[p->ty_num++] = sibling->y + HEIGHT_B(sibling);
+	}
+	p->tx[p->tx_num++] = 0;
+	p->ty[p->ty_num++] = g_font_height;
+	p->mx = mx = place_unique(p->xs, p->mx);
+	p->my = my = place_unique(p->ys, p->my);
+	p->tx_num = place_unique(p->tx, p->tx_num);
+	p->ty_num = place_unique(p->ty, p->ty_num);
+	for (i = 0; p->tx_num > i; ++i) {
+		p->tx_cell0[i] = place_cell(p->xs, mx, p->tx[i]);
+		p->tx_cell1[i] = place_cell(p->xs, mx, p->tx[i] +
+		    p->width_b);
+	}
+	if (0 == mx) {
+		return;
+	}
+
+	/*
+	 * Coverage from corner deltas, cell (i,j) starts at (xs[i],ys[j]).
+	 * Cells are stored by row so that a candidate row walks memory in
+	 * order.
+	 */
+	REALLOC(p->delta, mx * my);
+	REALLOC(p->cell, mx * my);
+	memset(p->delta, 0, mx * my * sizeof *p->delta);
+	TAILQ_FOREACH(sibling, &g_client_list[g_workspace_cur], next) {
+		size_t i0, i1, j0, j1;
+
+		if (sibling == a_client) {
+			continue;
+		}
+		i0 = place_cell(p->xs, mx, sibling->x);
+		i1 = place_cell(p->xs, mx, sibling->x + WIDTH_B(sibling));
+		j0 = place_cell(p->ys, my, sibling->y);
+		j1 = place_cell(p->ys, my, sibling->y + HEIGHT_B(sibling));
+		++p->delta[j0 * mx + i0];
+		--p->delta[j0 * mx + i1];
+		--p->delta[j1 * mx + i0];
+		++p->delta[j1 * mx + i1];
+	}
+
+	/*
+	 * a: integral along y in column i up to ys[j].
+	 * b: integral along x in row j up to xs[i].
+	 * s: integral over everything below and left of (xs[i],ys[j]).
+	 */
+	for (j = 0; my > j; ++j) {
+		for (i = 0; mx > i; ++i) {
+			struct PlaceCell *c = &p->cell[j * mx + i];
+			struct PlaceCell const *left, *up;
+
+			c->cov = p->delta[j * mx + i];
+			c->a = c->b = c->s = 0;
+			if (0 < j) {
+				up = c - mx;
+				c->cov += up->cov;
+				c->a = up->a + up->cov * (p->ys[j] - p->ys[j -
+				    1]);
+				if (0 < i) {
+					c->cov -= up[-1].cov;
+				}
+			}
+			if (0 < i) {
+				left = c - 1;
+				c->cov += left->cov;
+				c->b = left->b + left->cov * (p->xs[i] -
+				    p->xs[i - 1]);
+				c->s = left->s + (p->xs[i] - p->xs[i - 1]) *
+				    left->a;
+			}
+		}
+	}
+}
+
+/* Index of the last grid edge <= value, or the count if there is none. */
+size_t
+place_cell(int const *a_edge, size_t a_num, int a_value)
+{
+	size_t lo = 0, hi = a_num;
+
+	while (lo < hi) {
+		size_t mid = (lo + hi) / 2;
+
+		if (a_edge[mid] <= a_value) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return 0 == lo ? a_num : lo - 1;
+}
+
+/*
+ * Sibling coverage integrated over everything below and left of (x,y),
+ * given the grid cells of x and y.
+ */
+double
+place_integral(int a_x, size_t a_i, int a_y, size_t a_j)
+{
+	struct Place const *p = &g_place;
+	struct PlaceCell const *c;
+	double dx, dy;
+
+	if (p->mx == a_i || p->my == a_j) {
+		return 0;
+	}
+	c = &p->cell[a_j * p->mx + a_i];
+	dx = a_x - p->xs[a_i];
+	dy = a_y - p->ys[a_j];
+	return c->s + dx * c->a + dy * c->b + dx * dy * c->cov;
+}
+
+/* Sorts and removes duplicates, returns the new count. */
+size_t
+place_unique(int *a_array, size_t a_num)
+{
+	size_t i, j;
+
+	if (0 == a_num) {
+		return 0;
+	}
+	qsort(a_array, a_num, sizeof *a_array, int_cmp);
+	for (i = j = 1; a_num > i; ++i) {
+		if (a_array[j - 1] != a_array[i]) {
+			a_array[j++] = a_array[i];
+		}
+	}
+	return j;
+}
+
+/*
+ * Maps the snapshot and hashes it by window so that each child is looked up
+ * once. Restored windows come first in the order they were saved, and are
+ * cleared from the children.
+ */
+size_t
+persist_load(int a_fd, struct Adopt *a_adopt, xcb_window_t *a_child, size_t
+    a_child_num, xcb_window_t *a_focus)
+{
+	struct PersistHeader const *header;
+	struct PersistClient const *pc;
+	struct stat st;
+	size_t *table, *match, adopt_num, i, j, mask, size;
+	void *map;
+
+	map = MAP_FAILED;
+	if (0 == fstat(a_fd, &st) && sizeof *header <= (size_t)st.st_size) {
+		map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, a_fd, 0);
+	}
+	if (MAP_FAILED == map) {
+		warnx("Could not read persist info.");
+		return 0;
+	}
+	header = map;
+	pc = (void const *)(header + 1);
+	if (0 != memcmp(header->magic, "hwmstate", sizeof header->magic) ||
+	    1 != header->version || (size_t)st.st_size != sizeof *header +
+	    header->num * sizeof *pc) {
+		warnx("Ignoring persist info of unknown format.");
+		munmap(map, st.st_size);
+		return 0;
+	}
+	g_workspace_cur = MIN(LENGTH(c_workspace_label) - 1,
+	    header->workspace);
+	*a_focus = header->focus;
+
+	/* Slots hold index + 1, 0 is free. */
+	for (size = 1; 2 * header->num > size; size <<= 1)
+		;
+	mask = size - 1;
+	CALLOC(table, size);
+	CALLOC(match, header->num + 1);
+	for (i = 0; header->num > i; ++i) {
+		for (j = client_slot_hash(pc[i].window) & mask; table[j];
+		    j = (j + 1) & mask)
+			;
+		table[j] = i + 1;
+	}
+	for (i = 0; a_child_num > i; ++i) {
+		for (j = client_slot_hash(a_child[i]) & mask; table[j];
+		    j = (j + 1) & mask) {
+			if (pc[table[j] - 1].window == a_child[i]) {
+				match[table[j] - 1] = i + 1;
+				break;
+			}
+		}
+	}
+	adopt_num = 0;
+	for (i = 0; header->num > i; ++i) {
+		struct Adopt *adopt;
+
+		if (0 == match[i]) {
+			continue;
+		}
+		adopt = &a_adopt[adopt_num++];
+		adopt->window = a_child[match[i] - 1];
+		for (j = 0; LENGTH(adopt->data) > j; ++j) {
+			adopt->data[j] = pc[i].data[j];
+		}
+		/* Written by a build with other workspaces, maybe. */
+		adopt->data[0] = MIN((int)LENGTH(c_workspace_label) - 1,
+		    adopt->data[0]);
+		if (MAX_NOPE > adopt->data[4] || MAX_VERT < adopt->data[4]) {
+			adopt->data[4] = MAX_NOPE;
+		}
+		a_child[match[i] - 1] = XCB_NONE;
+	}
+	free(table);
+	free(match);
+	munmap(map, st.st_size);
+	return adopt_num;
+}
+
+/* Written next to the old one and renamed over it, never half done. */
+void
+persist_save()
+{
+	char path[sizeof c_persist_file + 4];
+	int fd, is_ok;
+
+	sprintf(path, "%s.tmp", c_persist_file);
+	if (-1 == (fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644))) {
+		warn("Could not save persist info '%s'", path);
+		return;
+	}
+	is_ok = persist_write(fd);
+	is_ok &= 0 == close(fd);
+	if (!is_ok || 0 != rename(path, c_persist_file)) {
+		warn("Could not save persist info '%s'", c_persist_file);
+		remove(path);
+	}
+}
+
+int
+persist_write(int a_fd)
+{
+	struct PersistHeader *header;
+	struct PersistClient *pc;
+	char *buf;
+	char const *p;
+	size_t i, num, size;
+	ssize_t ret;
+
+	num = 0;
+	for (i = 0; LENGTH(c_workspace_label) > i; ++i) {
+		struct Client *c;
+
+		TAILQ_FOREACH(c, &g_client_list[i], next) {
+			++num;
+		}
+	}
+	size = sizeof *header + num * sizeof *pc;
+	CALLOC(buf, size);
+	header = (void *)buf;
+	memcpy(header->magic, "hwmstate", sizeof header->magic);
+	header->version = 1;
+	header->workspace = g_workspace_cur;
+	header->focus = g_focus ? g_focus->window : (xcb_window_t)XCB_NONE;
+	header->num = num;
+	pc = (void *)(header + 1);
+	for (i = 0; LENGTH(c_workspace_label) > i; ++i) {
+		struct Client *c;
+
+		TAILQ_FOREACH(c, &g_client_list[i], next) {
+			pc->window = c->window;
+			pc->data[0] = i;
+			pc->data[1] = c->is_urgent;
+			pc->data[2] = c->x;
+			pc->data[3] = c->y;
+			pc->data[4] = c->maximize;
+			pc->data[5] = c->border_width;
+			pc->data[6] = c->max_old_x;
+			pc->data[7] = c->max_old_y;
+			pc->data[8] = c->max_old_width;
+			pc->data[9] = c->max_old_height;
+			++pc;
+		}
+	}
+	for (p = buf; 0 < size; p += ret, size -= ret) {
+		if (0 >= (ret = write(a_fd, p, size))) {
+			break;
+		}
+	}
+	free(buf);
+	return 0 == size;
+}
+
+xcb_get_property_reply_t *
+property_reply(xcb_get_property_cookie_t a_cookie, int a_line)
+{
+	return reply_get(xcb_get_property_reply(g_conn, a_cookie, NULL),
+	    a_line);
+}
+
+void
+randr_flush()
+{
+	struct RandrCookie cookie;
+
+	randr_request(&cookie);
+	randr_update(&cookie);
+}
+
+void
+randr_request(struct RandrCookie *a_cookie)
+{
+	a_cookie->res = xcb_randr_get_screen_resources_current(g_conn,
+	    g_root);
+	a_cookie->primary = xcb_randr_get_output_primary(g_conn, g_root);
+}
+
+/*
+ * Diffs the outputs against the current views. Views of unchanged outputs
+ * keep their bars, and only clients whose centre was on a removed or
+ * changed output are placed again.
+ */
+void
+randr_update(struct RandrCookie const *a_cookie)
+{
+	xcb_timestamp_t timestamp;
+	xcb_randr_get_screen_resources_current_reply_t *res;
+	xcb_randr_output_t *output_array;
+	xcb_randr_get_output_info_cookie_t *cookie_array;
+	xcb_randr_get_crtc_info_cookie_t *crtc_cookie_array;
+	xcb_randr_get_output_primary_reply_t *primary;
+	xcb_randr_mode_info_t const *mode_array;
+	struct ViewList fresh;
+	struct View *view;
+	xcb_rectangle_t *stale;
+	char *has_crtc;
+	size_t stale_num, k;
+	int i, j, len, mode_num;
+
+	/* Get randr output IDs. */
+	res = REPLY(xcb_randr_get_screen_resources_current_reply(g_conn,
+	    a_cookie->res, NULL));
+	primary = REPLY(xcb_randr_get_output_primary_reply(g_conn,
+	    a_cookie->primary, NULL));
+	if (!res) {
+		free(primary);
+		view_fallback();
+		return;
+	}
+	timestamp = res->config_timestamp;
+	len = xcb_randr_get_screen_resources_current_outputs_length(res);
+	output_array = xcb_randr_get_screen_resources_current_outputs(res);
+	mode_num = xcb_randr_get_screen_resources_current_modes_length(res);
+	mode_array = xcb_randr_get_screen_resources_current_modes(res);
+
+	CALLOC(cookie_array, len);
+	CALLOC(crtc_cookie_array, len);
+	CALLOC(has_crtc, len);
+	for (i = 0; len > i; ++i) {
+		cookie_array[i] = xcb_randr_get_output_info(g_conn,
+		    output_array[i], timestamp);
+	}
+	/* Ask for every CRTC before waiting on any of them. */
+	for (i = 0; len > i; ++i) {
+		xcb_randr_get_output_info_reply_t *output_info;
+
+		if (!(output_info = REPLY(xcb_randr_get_output_info_reply(
+		    g_conn, cookie_array[i], NULL)))) {
+			continue;
+		}
+		if (XCB_NONE != output_info->crtc) {
+			crtc_cookie_array[i] = xcb_randr_get_crtc_info(g_conn,
+			    output_info->crtc, timestamp);
+			has_crtc[i] = 1;
+		}
+		free(output_info);
+	}
+	stale_num = 0;
+	TAILQ_FOREACH(view, &g_view_list, next) {
+		++stale_num;
+	}
+	CALLOC(stale, stale_num + 1);
+	stale_num = 0;
+	TAILQ_INIT(&fresh);
+	for (i = 0; len > i; ++i) {
+		xcb_randr_get_crtc_info_reply_t *crtc;
+
+		if (!has_crtc[i] || !(crtc =
+		    REPLY(xcb_randr_get_crtc_info_reply(g_conn,
+		    crtc_cookie_array[i], NULL)))) {
+			continue;
+		}
+		TAILQ_FOREACH(view, &g_view_list, next) {
+			if (output_array[i] == view->output) {
+				break;
+			}
+		}
+		if (!view) {
+			CALLOC(view, 1);
+			view->output = output_array[i];
+		} else {
+			TAILQ_REMOVE(&g_view_list, view, next);
+		}
+		if (XCB_NONE == view->bar || view->x != crtc->x || view->y !=
+		    crtc->y || view->width != crtc->width || view->height !=
+		    crtc->height) {
+			if (XCB_NONE != view->bar) {
+				xcb_rectangle_t *r = &stale[stale_num++];
+
+				r->x = view->x;
+				r->y = view->y;
+				r->width = view->width;
+				r->height = view->height;
+			}
+			view->x = crtc->x;
+			view->y = crtc->y;
+			view->width = crtc->width;
+			view->height = crtc->height;
+			bar_reset(view);
+		}
+		view->rate = 0;
+		for (j = 0; mode_num > j; ++j) {
+			xcb_randr_mode_info_t const *mode = &mode_array[j];
+
+			if (mode->id == crtc->mode && mode->htotal &&
+			    mode->vtotal) {
+				view->rate = (int)((double)mode->dot_clock /
+				    ((double)mode->htotal * mode->vtotal) +
+				    0.5);
+				break;
+			}
+		}
+		if (primary && primary->output == view->output) {
+			TAILQ_INSERT_HEAD(&fresh, view, next);
+		} else {
+			TAILQ_INSERT_TAIL(&fresh, view, next);
+		}
+		free(crtc);
+	}
+	free(cookie_array);
+	free(crtc_cookie_array);
+	free(has_crtc);
+	free(res);
+	free(primary);
+
+	/*
+	 * Without any active CRTC, e.g. mid-switch, keep what we have, or
+	 * make do with the whole screen if there is nothing yet.
+	 */
+	if (TAILQ_EMPTY(&fresh)) {
+		free(stale);
+		view_fallback();
+		return;
+	}
+	while (!TAILQ_EMPTY(&g_view_list)) {
+		xcb_rectangle_t *r = &stale[stale_num++];
+
+		view = TAILQ_FIRST(&g_view_list);
+		TAILQ_REMOVE(&g_view_list, view, next);
+		r->x = view->x;
+		r->y = view->y;
+		r->width = view->width;
+		r->height = view->height;
+		view_free(view);
+	}
+	while (!TAILQ_EMPTY(&fresh)) {
+		view = TAILQ_FIRST(&fresh);
+		TAILQ_REMOVE(&fresh, view, next);
+		TAILQ_INSERT_TAIL(&g_view_list, view, next);
+	}
+
+	for (k = 0; 0 < stale_num && LENGTH(c_workspace_label) > k; ++k) {
+		struct Client *c;
+
+		TAILQ_FOREACH(c, &g_client_list[k], next) {
+			struct View const *to;
+			int const c_x = c->x + WIDTH_B(c) / 2;
+			int const c_y = c->y + HEIGHT_B(c) / 2;
+			size_t l;
+
+			for (l = 0; stale_num > l; ++l) {
+				xcb_rectangle_t const *r = &stale[l];
+
+				if (r->x <= c_x && c_x < r->x + r->width &&
+				    r->y <= c_y && c_y < r->y + r->height) {
+					break;
+				}
+			}
+			if (stale_num == l) {
+				continue;
+			}
+			to = view_find(c_x, c_y);
+			c->x = VIEW_LEFT(to);
+			c->y = VIEW_TOP(to);
+			client_place(c, k);
+			if (g_workspace_cur == k) {
+				client_move(c, VISIBLE);
+			}
+		}
+	}
+	free(stale);
+	g_do_bar_redraw = 1;
+}
+
+/* Every reply passes through here so it can be audited and traced. */
+void *
+reply_get(void *a_reply, int a_line)
+{
+	xcb_generic_reply_t const *reply = a_reply;
+
+	audit_count(a_line);
+	if (g_trace_is_replay) {
+		return trace_reply(a_reply);
+	}
+	if (g_trace) {
+		trace_write(TRACE_REPLY, a_reply, reply ? 32 + 4 *
+		    reply->length : 0);
+	}
+	return a_reply;
+}
+
+/*
+ * Execs over ourselves and passes the state on in a file whose fd is
+ * inherited, so no shell loop is needed. The file lives in memory where
+ * memfd_create exists, else it is an unlinked temporary next to the persist
+ * file. The new image still adopts the windows through the server. Returns
+ * only on failure.
+ */
+void
+restart(char **a_argv)
+{
+	char fd_str[16];
+	char **argv;
+	size_t i, j, num;
+	int fd;
+#if !defined(MFD_CLOEXEC)
+	char path[sizeof c_persist_file + 16];
+#endif
+
+#if defined(MFD_CLOEXEC)
+	if (-1 == (fd = memfd_create("hwm.state", 0))) {
+		warn("Could not hand over state in memory");
+		return;
+	}
+#else
+	sprintf(path, "%s.%d", c_persist_file, (int)getpid());
+	if (-1 == (fd = open(path, O_RDWR | O_CREAT | O_EXCL, 0600))) {
+		warn("Could not hand over state in '%s'", path);
+		return;
+	}
+	unlink(path);
+#endif
+	if (!persist_write(fd)) {
+		warn("Could not hand over state");
+		close(fd);
+		return;
+	}
+	for (num = 0; a_argv[num]; ++num)
+		;
+	CALLOC(argv, num + 3);
+	/* A new image would truncate the trace, so it ends here. */
+	for (i = j = 0; num > i; ++i) {
+		if ((0 == strcmp(a_argv[i], "--record") || 0 ==
+		    strcmp(a_argv[i], "--restore")) && num > i + 1) {
+			++i;
+		} else {
+			argv[j++] = a_argv[i];
+		}
+	}
+	sprintf(fd_str, "%d", fd);
+	argv[j++] = "--restore";
+	argv[j++] = fd_str;
+
+	if (g_trace) {
+		fclose(g_trace);
+		g_trace = NULL;
+	}
+
+	/* The new image makes its own connection once this one is gone. */
+	xcb_flush(g_conn);
+	fcntl(xcb_get_file_descriptor(g_conn), F_SETFD, FD_CLOEXEC);
+	execvp(argv[0], argv);
+	warn("execvp(%s)", argv[0]);
+	free(argv);
+	close(fd);
+}
+
+void
+root_name_update()
+{
+	xcb_get_property_reply_t *reply;
+	int do_default_name;
+
+	do_default_name = 1;
+	g_has_root_name = 0;
+	if ((reply = REPLY_PROPERTY(xcb_icccm_get_wm_name(g_conn, g_root)))) {
+		char const *p = xcb_get_property_value(reply);
+		size_t len = xcb_get_property_value_length(reply);
+
+		g_has_root_name = 0 != len;
+		if (0 != len) {
+			if ((g_is_root_urgent = ('!' == *p))) {
+				++p;
+				--len;
+			}
+			string_convert(&g_root_name, p, len);
+			do_default_name = 0;
+		}
+		free(reply);
+	}
+	if (do_default_name) {
+		string_convert(&g_root_name, "<hwm>", 5);
+	}
+}
+
+enum Scheme
+scheme_get(int a_is_focused, int a_is_urgent)
+{
+	if (a_is_urgent) {
+		return g_blink ? SCHEME_URGENT2 : SCHEME_URGENT1;
+	}
+	return a_is_focused ? SCHEME_FOCUS : SCHEME_NORMAL;
+}
+
+/* Events by type, actions past them, and -1 for anything else. */
+char const *
+scope_name(int a_scope, char *a_buf)
+{
+	int const c_event_num = LENGTH(g_audit_event);
+
+	if (0 > a_scope) {
+		return "other";
+	}
+	if (c_event_num <= a_scope) {
+		return g_audit[a_scope - c_event_num].name;
+	}
+	if (0 != g_randr_evbase && a_scope >= g_randr_evbase && a_scope <=
+	    g_randr_evbase + XCB_RANDR_NOTIFY) {
+		sprintf(a_buf, "randr%d", a_scope - g_randr_evbase);
+	} else {
+		sprintf(a_buf, "event%d", a_scope);
+	}
+	return a_buf;
+}
+
+/*
+ * Raises the skyline to the given bottom over [x,x+width). Steps narrower
+ * than the snap margin cannot take a window and are filled up.
+ */
+void
+skyline_add(int a_x, int a_bottom, int a_width)
+{
+	struct Skyline *seg, *tmp;
+	size_t i, num = 0;
+	int const c_x1 = a_x + a_width;
+
+	tmp = g_skyline_tmp;
+	for (i = 0; g_skyline_num > i; ++i) {
+		struct Skyline const *old = &g_skyline[i];
+		int const c_old_x1 = old->x + old->width;
+
+		if (old->x < a_x) {
+			tmp[num] = *old;
+			tmp[num].width = MIN(c_old_x1, a_x) - old->x;
+			++num;
+		}
+		if (old->x <= a_x && a_x < c_old_x1) {
+			tmp[num].x = a_x;
+			tmp[num].y = a_bottom;
+			tmp[num].width = a_width;
+			++num;
+		}
+		if (c_x1 < c_old_x1) {
+			tmp[num].x = MAX(old->x, c_x1);
+			tmp[num].y = old->y;
+			tmp[num].width = c_old_x1 - tmp[num].x;
+			++num;
+		}
+	}
+	for (i = 0; num > i && 1 < num; ++i) {
+		int left_y, right_y;
+
+		seg = &tmp[i];
+		left_y = 0 < i ? seg[-1].y : INT_MAX;
+		right_y = num > i + 1 ? seg[1].y : INT_MAX;
+		if (c_snap_margin > seg->width && seg->y < MIN(left_y,
+		    right_y)) {
+			seg->y = MIN(left_y, right_y);
+		}
+	}
+	g_skyline_num = 0;
+	for (i = 0; num > i; ++i) {
+		if (0 < g_skyline_num && g_skyline[g_skyline_num - 1].y ==
+		    tmp[i].y) {
+			g_skyline[g_skyline_num - 1].width += tmp[i].width;
+		} else {
+			g_skyline[g_skyline_num++] = tmp[i];
+		}
+	}
+}
+
+/* Lowest, then leftmost, spot on the skyline for the given size. */
+int
+skyline_fit(int a_width, int a_height, int a_bottom, int *a_x, int *a_y)
+{
+	struct Skyline const *last;
+	size_t i, j;
+	int best_y = a_bottom, found = 0;
+
+	last = &g_skyline[g_skyline_num - 1];
+	for (i = 0; g_skyline_num > i; ++i) {
+		int x, y, rem;
+
+		x = g_skyline[i].x;
+		if (x + a_width > last->x + last->width) {
+			break;
+		}
+		for (j = i, y = 0, rem = a_width; 0 < rem; ++j) {
+			y = MAX(y, g_skyline[j].y);
+			rem -= g_skyline[j].width;
+		}
+		if (y + a_height <= a_bottom && (!found || y < best_y)) {
+			best_y = y;
+			*a_x = x;
+			*a_y = y;
+			found = 1;
+		}
+	}
+	return found;
+}
+
+void
+stats_print()
+{
+	char const *c_probe_name[] = {"bar_draw", "client_place", "move",
+		"resize", "browse"};
+	char name[16];
+	FILE *file;
+	size_t i;
+
+	fprintf(stderr, "hwm: batches=%lu events=%lu coalesced=%lu "
+	    "startup=%.1fms.\n", g_stat_batch_num, g_stat_event_num,
+	    g_stat_coalesced_num, g_stat_startup);
+	if (!(file = fopen(c_stats_file, "w"))) {
+		warn("Could not write stats to '%s'", c_stats_file);
+		return;
+	}
+	for (i = 0; LENGTH(g_hist_event) > i; ++i) {
+		histogram_print(file, scope_name(i, name), &g_hist_event[i]);
+	}
+	for (i = 0; PROBE_NUM > i; ++i) {
+		histogram_print(file, c_probe_name[i], &g_hist_probe[i]);
+	}
+	fprintf(file, "\nRound trips:\n");
+	for (i = 0; LENGTH(g_audit_event) > i; ++i) {
+		if (g_audit_event[i]) {
+			fprintf(file, "%-16s %lu\n", scope_name(i, name),
+			    g_audit_event[i]);
+		}
+	}
+	for (i = 0; LENGTH(g_audit) > i; ++i) {
+		struct Audit const *audit = &g_audit[i];
+
+		if (audit->run_num) {
+			fprintf(file, "%-16s %lu runs=%lu max=%lu "
+			    "budget=%d\n", audit->name, audit->reply_num,
+			    audit->run_num, audit->reply_max, audit->budget);
+		}
+	}
+	for (i = 0; g_audit_site_num > i; ++i) {
+		struct AuditSite const *site = &g_audit_site[i];
+
+		fprintf(file, "hwm.c:%-10d %lu %s\n", site->line, site->num,
+		    scope_name(site->scope, name));
+	}
+	fclose(file);
+}
+
+void
+stats_signal(int a_signo)
+{
+	/* SysV semantics reset the handler. */
+	signal(a_signo, stats_signal);
+	g_do_stats = 1;
+}
+
+/* Same sysfs data as hlinuxbat, the supplies are looked up once. */
+void
+status_battery(char *a_buf, size_t a_size)
+{
+	static char const c_dir[] = "/sys/class/power_supply";
+	static int s_is_probed, s_ac_fd = -1, s_bat_fd = -1;
+	static char s_ac_path[300], s_bat_path[300];
+	char buf[1024], *line;
+	long capacity, now, rate, remain;
+	int percentage, is_ac, len;
+
+	if (!s_is_probed) {
+		struct dirent *dirent;
+		DIR *dir;
+
+		s_is_probed = 1;
+		if (!(dir = opendir(c_dir))) {
+			return;
+		}
+		while ((dirent = readdir(dir))) {
+			char path[300];
+			int fd = -1;
+
+			sprintf(path, "%s/%s/type", c_dir, dirent->d_name);
+			len = status_read(&fd, path, buf, sizeof buf);
+			if (-1 != fd) {
+				close(fd);
+			}
+			if (0 >= len) {
+				continue;
+			}
+			if (0 == strncmp(buf, "Mains", 5)) {
+				sprintf(s_ac_path, "%s/%s/online", c_dir,
+				    dirent->d_name);
+			} else if (0 == strncmp(buf, "Battery", 7)) {
+				sprintf(s_bat_path, "%s/%s/uevent", c_dir,
+				    dirent->d_name);
+			}
+		}
+		closedir(dir);
+	}
+	if ('\0' == s_ac_path[0] || 0 >= status_read(&s_ac_fd, s_ac_path,
+	    buf, sizeof buf)) {
+		return;
+	}
+	is_ac = '0' != buf[0];
+	capacity = now = rate = 0;
+	if ('\0' != s_bat_path[0] && 0 < status_read(&s_bat_fd,
+	    s_bat_path, buf, sizeof buf)) {
+		for (line = strtok(buf, "\n"); line; line = strtok(NULL,
+		    "\n")) {
+#define MATCH(name, var) \
+	if (0 == strncmp(line, name, sizeof name - 1)) \
+		var = strtol(line + sizeof name - 1, NULL, 10)
+			MATCH("POWER_SUPPLY_CHARGE_FULL=", capacity);
+			MATCH("POWER_SUPPLY_CHARGE_NOW=", now);
+			MATCH("POWER_SUPPLY_CURRENT_NOW=", rate);
+			MATCH("POWER_SUPPLY_ENERGY_FULL=", capacity);
+			MATCH("POWER_SUPPLY_ENERGY_NOW=", now);
+			MATCH("POWER_SUPPLY_POWER_NOW=", rate);
+#undef MATCH
+		}
+	}
+	if (0 >= capacity) {
+		snprintf(a_buf, a_size, "%s", is_ac ? "AC" : "Bat");
+		return;
+	}
+	percentage = 100.0 * now / capacity;
+	remain = is_ac ? capacity - now : now;
+	len = snprintf(a_buf, a_size, "%s%s %d%%", !is_ac &&
+	    c_status_battery_min >= percentage ? "!" : "", is_ac ? "AC" :
+	    "Bat", percentage);
+	if (60 <= rate && 0 <= len && a_size > (size_t)len) {
+		snprintf(a_buf + len, a_size - len, " (%ldh %02ldm)", remain /
+		    rate, remain / (rate / 60) % 60);
+	}
+}
+
+void
+status_clock(char *a_buf, size_t a_size)
+{
+	time_t t;
+
+	t = time(NULL);
+	if (0 == strftime(a_buf, a_size, c_status_clock_format,
+	    localtime(&t))) {
+		a_buf[0] = '\0';
+	}
+}
+
+void
+status_load(char *a_buf, size_t a_size)
+{
+	static int s_fd = -1;
+	char buf[128];
+
+	if (0 < status_read(&s_fd, "/proc/loadavg", buf, sizeof buf)) {
+		snprintf(a_buf, a_size, "load %.4s", strtok(buf, " "));
+	}
+}
+
+void
+status_memory(char *a_buf, size_t a_size)
+{
+	static int s_fd = -1;
+	char buf[4096], *p;
+	long total, avail;
+
+	if (0 >= status_read(&s_fd, "/proc/meminfo", buf, sizeof buf)) {
+		return;
+	}
+	total = avail = 0;
+	if ((p = strstr(buf, "MemTotal:"))) {
+		total = strtol(p + 9, NULL, 10);
+	}
+	if ((p = strstr(buf, "MemAvailable:"))) {
+		avail = strtol(p + 13, NULL, 10);
+	}
+	if (0 < total) {
+		snprintf(a_buf, a_size, "mem %d%%", (int)(100.0 * (total -
+		    avail) / total));
+	}
+}
+
+/* Keeps the file open and rereads it from the start. */
+int
+status_read(int *a_fd, char const *a_path, char *a_buf, size_t a_size)
+{
+	ssize_t len;
+
+	if (-1 == *a_fd && -1 == (*a_fd = open(a_path, O_RDONLY |
+	    O_CLOEXEC))) {
+		return -1;
+	}
+	if (0 > (len = pread(*a_fd, a_buf, a_size - 1, 0))) {
+		close(*a_fd);
+		*a_fd = -1;
+		return -1;
+	}
+	a_buf[len] = '\0';
+	return len;
+}
+
+/*
+ * Runs the modules that are due and sleeps until the next one. Deadlines are
+ * aligned to the wall clock, so minutes tick on time and modules with the
+ * same period share wakeups.
+ */
+void
+status_update()
+{
+	struct timespec ts;
+	double now, next;
+	size_t i;
+	long phase;
+
+	now = time_get();
+	clock_gettime(CLOCK_REALTIME, &ts);
+	phase = ts.tv_sec % 86400 * 1000 + ts.tv_nsec / 1000000;
+	next = -1;
+	for (i = 0; LENGTH(c_status_bind) > i; ++i) {
+		struct Status *st = &g_status[i];
+		int const c_period = c_status_bind[i].period;
+
+		if (now >= st->time) {
+			char buf[sizeof st->raw];
+
+			buf[0] = '\0';
+			c_status_bind[i].func(buf, sizeof buf);
+			if (0 != strcmp(buf, st->raw)) {
+				char const *p = buf;
+
+				strcpy(st->raw, buf);
+				if ((st->is_urgent = '!' == *p)) {
+					++p;
+				}
+				string_convert(&st->text, p, strlen(p));
+				g_do_bar_redraw = 1;
+			}
+			st->time = now + c_period - phase % c_period;
+		}
+		if (0 > next || next > st->time) {
+			next = st->time;
+		}
+	}
+	timer_add(next - now, status_update);
+}
+
+/*
+ * UTF-8 to the UCS-2 of 16-bit fonts. ASCII is checked a word at a time and
+ * widened without branches. Bytes that do not start a valid sequence are
+ * taken as Latin-1, as old WM_NAMEs are, and code points beyond UCS-2 become
+ * U+FFFD. A full string always ends on a whole character. Widths of the
+ * first 256 glyphs are cached per font.
+ */
+void
+string_convert(struct String *a_out, char const *a_in, size_t a_inlen)
+{
+	/* Sequence length by the top five bits of the lead byte. */
+	static unsigned char const c_len[32] = {
+		1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+		0, 0, 0, 0, 0, 0, 0, 0, 2, 2, 2, 2, 3, 3, 4, 0
+	};
+	static unsigned char const c_mask[5] = {0, 0x7f, 0x1f, 0x0f, 0x07};
+	static uint32_t const c_min[5] = {0, 0, 0x80, 0x800, 0x10000};
+	static xcb_query_font_reply_t const *s_font;
+	static int s_width[256];
+	unsigned long const c_high = (unsigned long)-1 / 0xff * 0x80;
+	unsigned char const *u, *end;
+	xcb_char2b_t *out, *out_end;
+	size_t i;
+	int width;
+
+	if (s_font != g_font_info) {
+		s_font = g_font_info;
+		for (i = 0; LENGTH(s_width) > i; ++i) {
+			if (0 > (s_width[i] = glyph_width(0, i)) && 0 >
+			    (s_width[i] = glyph_width(
+			    g_font_info->default_char >> 8,
+			    g_font_info->default_char & 0xff))) {
+				s_width[i] = 0;
+			}
+		}
+	}
+	u = (unsigned char const *)a_in;
+	end = u + a_inlen;
+	out = a_out->str;
+	out_end = out + LENGTH(a_out->str);
+	width = 0;
+	while (out < out_end && u < end) {
+		uint32_t cp;
+		size_t len;
+
+		if (sizeof(unsigned long) <= (size_t)(end - u) &&
+		    sizeof(unsigned long) <= (size_t)(out_end - out)) {
+			unsigned long w;
+
+			memcpy(&w, u, sizeof w);
+			if (0 == (c_high & w)) {
+				for (i = 0; sizeof w > i; ++i) {
+					out[i].byte1 = 0;
+					out[i].byte2 = u[i];
+					width += s_width[u[i]];
+				}
+				u += sizeof w;
+				out += sizeof w;
+				continue;
+			}
+		}
+		len = c_len[*u >> 3];
+		if ((size_t)(end - u) < len) {
+			len = 0;
+		}
+		cp = *u & c_mask[len];
+		for (i = 1; len > i; ++i) {
+			if (0x80 != (0xc0 & u[i])) {
+				len = 0;
+				break;
+			}
+			cp = cp << 6 | (0x3f & u[i]);
+		}
+		if (0 == len || c_min[len] > cp || (0xd800 <= cp && 0xdfff >=
+		    cp)) {
+			cp = *u;
+			len = 1;
+		} else if (0xffff < cp) {
+			cp = 0xfffd;
+		}
+		out->byte1 = cp >> 8;
+		out->byte2 = cp & 0xff;
+		if (0xff >= cp) {
+			width += s_width[cp];
+		} else {
+			int w;
+
+			if (0 <= (w = glyph_width(out->byte1, out->byte2)) ||
+			    0 <= (w = glyph_width(g_font_info->default_char >>
+			    8, g_font_info->default_char & 0xff))) {
+				width += w;
+			}
+		}
+		++out;
+		u += len;
+	}
+	a_out->length = out - a_out->str;
+	a_out->width = width;
+}
+
+int
+text_draw(xcb_drawable_t a_drawable, struct String const *a_text, enum
+    Scheme a_scheme, int a_x, int a_y)
+{
+	xcb_rectangle_t rect;
+	int width;
+
+	width = text_width(a_text);
+	rect.x = a_x;
+	rect.y = a_y;
+	rect.width = width;
+	rect.height = g_font_height;
+	xcb_poly_fill_rectangle(g_conn, a_drawable, g_gc_fill[a_scheme], 1,
+	    &rect);
+
+	xcb_image_text_16(g_conn, a_text->length, a_drawable,
+	    g_gc_text[a_scheme], a_x + c_text_padding, a_y + g_font_ascent,
+	    a_text->str);
+
+	--rect.width;
+	--rect.height;
+	xcb_poly_rectangle(g_conn, a_drawable, g_gc_text[a_scheme], 1,
+	    &rect);
+
+	return width;
+}
+
+int
+text_width(struct String const *a_text)
+{
+	return c_text_padding + a_text->width + c_text_padding;
+}
+
+double
+time_get()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return 1e3 * ts.tv_sec + 1e-6 * ts.tv_nsec;
+}
+
+/* Schedules or reschedules a_func to run once in a_ms. */
+void
+timer_add(double a_ms, void (*a_func)(void))
+{
+	struct Timer *t;
+	size_t i;
+
+	if (g_timer_num == (i = timer_find(a_func))) {
+		if (g_timer_cap == g_timer_num) {
+			g_timer_cap = MAX(8, 2 * g_timer_cap);
+			REALLOC(g_timer, g_timer_cap);
+		}
+		++g_timer_num;
+	}
+	t = &g_timer[i];
+	t->time = time_get() + a_ms;
+	t->func = a_func;
+	timer_sift(i);
+	timer_arm();
+}
+
+/* Nothing armed means no wakeups at all. */
+void
+timer_arm()
+{
+	struct itimerspec its;
+
+	ZERO(its);
+	if (0 < g_timer_num) {
+		double const c_s = g_timer[0].time / 1e3;
+
+		its.it_value.tv_sec = c_s;
+		its.it_value.tv_nsec = 1e9 * (c_s - its.it_value.tv_sec);
+		if (0 == its.it_value.tv_sec && 0 == its.it_value.tv_nsec) {
+			its.it_value.tv_nsec = 1;
+		}
+	}
+	if (-1 == timerfd_settime(g_timer_fd, TFD_TIMER_ABSTIME, &its,
+	    NULL)) {
+		warn("timerfd_settime");
+	}
+}
+
+size_t
+timer_find(void (*a_func)(void))
 {
-	struct Client *c;
+	size_t i;
 
-	c = client_get(a_event->window, NULL);
-	client_free(&c);
+	for (i = 0; g_timer_num > i && a_func != g_timer[i].func; ++i)
+		;
+	return i;
 }
 
 void
-my_exit()
+timer_remove(void (*a_func)(void))
 {
 	size_t i;
 
-	for (i = 0; LENGTH(c_workspace_label) > i; ++i) {
-		while (!TAILQ_EMPTY(&g_client_list[i])) {
-			struct Client *c;
-
-			c = TAILQ_FIRST(&g_client_list[i]);
-			TAILQ_REMOVE(&g_client_list[i], c, next);
-			client_free(&c);
-		}
-	}
-	view_clear();
-	if (g_conn) {
-		xcb_flush(g_conn);
-		xcb_disconnect(g_conn);
+	if (g_timer_num == (i = timer_find(a_func))) {
+		return;
 	}
-	if ((iconv_t)-1 != g_iconv) {
-		iconv_close(g_iconv);
+	g_timer[i] = g_timer[--g_timer_num];
+	if (g_timer_num > i) {
+		timer_sift(i);
 	}
-	FREE(g_workspace_label);
+	timer_arm();
 }
 
 void
-randr_update()
+timer_run()
 {
-	xcb_timestamp_t timestamp;
-	xcb_randr_get_screen_resources_current_reply_t *res;
-	xcb_randr_output_t *output_array;
-	xcb_randr_get_output_info_cookie_t *cookie_array;
-	xcb_randr_get_output_primary_reply_t *primary;
-	struct View *view;
-	int i, len;
+	char buf[8];
+	double now;
 
-	view_clear();
-
-	/* Get randr output IDs. */
-	res = xcb_randr_get_screen_resources_current_reply(g_conn,
-	    xcb_randr_get_screen_resources_current(g_conn, g_root), NULL);
-	if (!res) {
+	if (-1 == read(g_timer_fd, buf, sizeof buf)) {
 		return;
 	}
-	timestamp = res->config_timestamp;
-	len = xcb_randr_get_screen_resources_current_outputs_length(res);
-	output_array = xcb_randr_get_screen_resources_current_outputs(res);
-
-	primary = xcb_randr_get_output_primary_reply(g_conn,
-	    xcb_randr_get_output_primary(g_conn, g_root), NULL);
+	now = time_get();
+	while (0 < g_timer_num && now >= g_timer[0].time) {
+		void (*func)(void);
 
-	CALLOC(cookie_array, len);
-	for (i = 0; len > i; ++i) {
-		cookie_array[i] = xcb_randr_get_output_info(g_conn,
-		    output_array[i], timestamp);
+		func = g_timer[0].func;
+		timer_remove(func);
+		func();
 	}
-	for (i = 0; len > i; ++i) {
-		xcb_randr_get_output_info_reply_t *output_info;
-		xcb_randr_get_crtc_info_reply_t *crtc;
+	timer_arm();
+}
 
-		if (!(output_info = xcb_randr_get_output_info_reply(g_conn,
-		    cookie_array[i], NULL))) {
-			continue;
-		}
-		if (XCB_NONE == output_info->crtc) {
-			free(output_info);
-			continue;
-		}
-		crtc = xcb_randr_get_crtc_info_reply(g_conn,
-		    xcb_randr_get_crtc_info(g_conn, output_info->crtc,
-		    timestamp), NULL);
-		free(output_info);
-		if (!crtc) {
-			continue;
+void
+timer_sift(size_t a_i)
+{
+	struct Timer t;
+	size_t i, j;
+
+	t = g_timer[a_i];
+	for (i = a_i; 0 < i && g_timer[(i - 1) / 2].time > t.time; i = j) {
+		j = (i - 1) / 2;
+		g_timer[i] = g_timer[j];
+	}
+	for (; (j = 2 * i + 1) < g_timer_num; i = j) {
+		if (g_timer_num > j + 1 && g_timer[j].time >
+		    g_timer[j + 1].time) {
+			++j;
 		}
-		CALLOC(view, 1);
-		view->output = output_array[i];
-		view->x = crtc->x;
-		view->y = crtc->y;
-		view->width = crtc->width;
-		view->height = crtc->height;
-		if (primary->output == view->output) {
-			TAILQ_INSERT_HEAD(&g_view_list, view, next);
-		} else {
-			TAILQ_INSERT_TAIL(&g_view_list, view, next);
+		if (g_timer[j].time >= t.time) {
+			break;
 		}
-		free(crtc);
+		g_timer[i] = g_timer[j];
 	}
-	assert(!TAILQ_EMPTY(&g_view_list));
-	free(cookie_array);
-	free(res);
-	free(primary);
-	bar_reset();
+	g_timer[i] = t;
 }
 
 void
-root_name_update()
+trace_done()
 {
-	xcb_icccm_get_text_property_reply_t icccm;
-	int do_default_name;
+	fprintf(stderr, "hwm: replayed %lu events in %.1f ms, captured over "
+	    "%u ms, %lu diverged.\n", g_trace_event_num,
+	    time_get() - g_trace_time0, (unsigned)g_trace_record.time,
+	    g_trace_diverged_num);
+	exit(0);
+}
 
-	do_default_name = 1;
-	if (xcb_icccm_get_wm_name_reply(g_conn, xcb_icccm_get_wm_name(g_conn,
-	    g_root), &icccm, NULL)) {
-		char const *p = icccm.name;
-		size_t len = icccm.name_len;
+/*
+ * Replays the next event, NULL where the recording found the queue empty.
+ * Replies that the handlers did not ask for this time are skipped.
+ */
+xcb_generic_event_t *
+trace_event()
+{
+	xcb_generic_event_t *event;
+	uint8_t type;
 
-		if (0 != len) {
-			if ((g_is_root_urgent = ('!' == *p))) {
-				++p;
-				--len;
-			}
-			string_convert(&g_root_name, p, len);
-			do_default_name = 0;
+	for (;;) {
+		if (!g_trace_has_record && 1 != fread(&g_trace_record,
+		    sizeof g_trace_record, 1, g_trace)) {
+			trace_done();
+		}
+		g_trace_has_record = 0;
+		if (TRACE_NONE == g_trace_record.type) {
+			return NULL;
+		}
+		if (TRACE_EVENT == g_trace_record.type) {
+			break;
 		}
-		xcb_icccm_get_text_property_reply_wipe(&icccm);
+		++g_trace_diverged_num;
+		fseek(g_trace, g_trace_record.size, SEEK_CUR);
 	}
-	if (do_default_name) {
-		string_convert(&g_root_name, "<hwm>", 5);
+	CALLOC(event, 1);
+	if (1 != fread(event, 32, 1, g_trace)) {
+		free(event);
+		trace_done();
+	}
+	++g_trace_event_num;
+	/* Our own resources and the RANDR events moved since recording. */
+	type = XCB_EVENT_RESPONSE_TYPE(event);
+	if (0 != g_trace_header.randr_evbase && type >=
+	    g_trace_header.randr_evbase && type <=
+	    g_trace_header.randr_evbase + XCB_RANDR_NOTIFY) {
+		event->response_type += g_randr_evbase -
+		    g_trace_header.randr_evbase;
+	} else if (XCB_EXPOSE == type) {
+		trace_rebase(&((xcb_expose_event_t *)event)->window);
+	} else if (XCB_BUTTON_PRESS == type) {
+		trace_rebase(&((xcb_button_press_event_t *)event)->event);
 	}
+	return event;
 }
 
 void
-string_convert(struct String *a_out, char const *a_in, size_t a_inlen)
+trace_open(char const *a_path, int a_is_replay)
 {
-	char *p = a_out->str;
-	size_t inlen = a_inlen;
-	size_t len;
-
-	len = LENGTH(a_out->str);
-	iconv(g_iconv, (char **)&a_in, &inlen, (char **)&p, &len);
-	a_out->length = (LENGTH(a_out->str) - len) / 2;
+	struct TraceHeader header;
+
+	ZERO(header);
+	memcpy(header.magic, "hwmtrace", sizeof header.magic);
+	header.version = 1;
+	header.resource_id_base = xcb_get_setup(g_conn)->resource_id_base;
+	header.randr_evbase = g_randr_evbase;
+	g_trace_is_replay = a_is_replay;
+	g_trace_time0 = time_get();
+	if (!(g_trace = fopen(a_path, a_is_replay ? "rb" : "wb"))) {
+		err(EXIT_FAILURE, "Could not open trace '%s'", a_path);
+	}
+	if (a_is_replay) {
+		if (1 != fread(&g_trace_header, sizeof g_trace_header, 1,
+		    g_trace) || 0 != memcmp(g_trace_header.magic,
+		    header.magic, sizeof header.magic) ||
+		    header.version != g_trace_header.version) {
+			errx(EXIT_FAILURE, "'%s' is not a version %u hwm "
+			    "trace.", a_path, (unsigned)header.version);
+		}
+	} else {
+		g_trace_header = header;
+		if (1 != fwrite(&header, sizeof header, 1, g_trace)) {
+			err(EXIT_FAILURE, "Could not write trace '%s'",
+			    a_path);
+		}
+	}
 }
 
-int
-text_draw(struct String const *a_text, int a_is_focused, int a_is_urgent, int
-    a_x, int a_y)
+void
+trace_rebase(xcb_window_t *a_id)
 {
-	xcb_rectangle_t rect;
-	uint32_t c_bg = a_is_urgent ? (g_blink ? g_color_urgent2_bg :
-	    g_color_urgent1_bg) : a_is_focused ? g_color_bar_fg :
-	    g_color_bar_bg;
-	uint32_t c_fg = a_is_urgent ? (g_blink ? g_color_urgent2_fg :
-	    g_color_urgent1_fg) : a_is_focused ? g_color_bar_bg :
-	    g_color_bar_fg;
-	int width;
+	xcb_setup_t const *setup;
 
-	width = text_width(a_text);
-	rect.x = a_x;
-	rect.y = a_y;
-	rect.width = width;
-	rect.height = g_font_height;
-	xcb_change_gc(g_conn, g_gc, XCB_GC_FOREGROUND, &c_bg);
-	xcb_poly_fill_rectangle(g_conn, g_pixmap, g_gc, 1, &rect);
+	setup = xcb_get_setup(g_conn);
+	if ((*a_id & ~setup->resource_id_mask) ==
+	    g_trace_header.resource_id_base) {
+		*a_id = setup->resource_id_base | (*a_id &
+		    setup->resource_id_mask);
+	}
+}
 
-	xcb_change_gc(g_conn, g_gc, XCB_GC_BACKGROUND, &c_bg);
-	xcb_change_gc(g_conn, g_gc, XCB_GC_FOREGROUND, &c_fg);
-	xcb_image_text_16(g_conn, a_text->length, g_pixmap, g_gc, a_x +
-	    c_text_padding, a_y + g_font_ascent,
-	    (xcb_char2b_t const *)a_text->str);
+/* Hands out the recorded reply instead of the live one, if in sync. */
+void *
+trace_reply(void *a_reply)
+{
+	void *reply;
 
-	--rect.width;
-	--rect.height;
-	xcb_poly_rectangle(g_conn, g_pixmap, g_gc, 1, &rect);
+	if (!g_trace_has_record && 1 != fread(&g_trace_record,
+	    sizeof g_trace_record, 1, g_trace)) {
+		return a_reply;
+	}
+	g_trace_has_record = 1;
+	if (TRACE_REPLY != g_trace_record.type) {
+		++g_trace_diverged_num;
+		return a_reply;
+	}
+	g_trace_has_record = 0;
+	free(a_reply);
+	if (0 == g_trace_record.size) {
+		return NULL;
+	}
+	reply = malloc(g_trace_record.size);
+	if (!reply) {
+		err(EXIT_FAILURE, "malloc(%u)", (unsigned)g_trace_record.size);
+	}
+	if (1 != fread(reply, g_trace_record.size, 1, g_trace)) {
+		FREE(reply);
+	}
+	return reply;
+}
 
-	return width;
+void
+trace_write(enum TraceType a_type, void const *a_data, size_t a_size)
+{
+	struct TraceRecord record;
+
+	ZERO(record);
+	record.type = a_type;
+	record.time = (uint32_t)(time_get() - g_trace_time0);
+	record.size = a_size;
+	if (1 != fwrite(&record, sizeof record, 1, g_trace) || (a_size && 1 !=
+	    fwrite(a_data, a_size, 1, g_trace))) {
+		warn("Could not write trace, stopped recording");
+		fclose(g_trace);
+		g_trace = NULL;
+	}
 }
 
-int
-text_width(struct String const *a_text)
+/*
+ * Sends only what differs from the last sent state of the touched clients.
+ * Changes to several windows go out under a server grab, so nothing is
+ * drawn in between, e.g. while switching workspaces.
+ */
+void
+txn_commit()
 {
-	xcb_query_text_extents_reply_t *reply;
-	int width;
+	size_t i, num;
+	int do_raise;
 
-	reply = xcb_query_text_extents_reply(g_conn,
-	    xcb_query_text_extents(g_conn, g_font, a_text->length,
-	    (xcb_char2b_t const *)a_text->str), NULL);
-	if (!reply) {
-		width = 0;
-	} else {
-		width = reply->overall_width;
-		free(reply);
+	/* Keep only touched clients that are still around and changed. */
+	do_raise = g_txn_top != g_txn_raise;
+	num = 0;
+	for (i = 0; g_txn_num > i; ++i) {
+		struct Client *c;
+
+		if ((c = client_get(g_txn_window[i], NULL))) {
+			c->is_pending = 0;
+			if (0 != memcmp(&c->sent, &c->want, sizeof c->sent) ||
+			    (do_raise && g_txn_raise == c->window)) {
+				g_txn_window[num++] = c->window;
+			}
+		}
+	}
+	g_txn_num = 0;
+	if (1 < num) {
+		xcb_grab_server(g_conn);
+	}
+	for (i = 0; num > i; ++i) {
+		struct Client *c;
+		uint32_t values[6], *p = values;
+		uint16_t mask = 0;
+
+		c = client_get(g_txn_window[i], NULL);
+#define TXN_FIELD(field, bit) do {\
+		if (c->sent.field != c->want.field) {\
+			mask |= bit;\
+			*p++ = c->want.field;\
+		}\
+	} while (0)
+		TXN_FIELD(x, XCB_CONFIG_WINDOW_X);
+		TXN_FIELD(y, XCB_CONFIG_WINDOW_Y);
+		TXN_FIELD(width, XCB_CONFIG_WINDOW_WIDTH);
+		TXN_FIELD(height, XCB_CONFIG_WINDOW_HEIGHT);
+		TXN_FIELD(border_width, XCB_CONFIG_WINDOW_BORDER_WIDTH);
+#undef TXN_FIELD
+		if (do_raise && g_txn_raise == c->window) {
+			mask |= XCB_CONFIG_WINDOW_STACK_MODE;
+			*p++ = XCB_STACK_MODE_TOP_IF;
+			g_txn_top = c->window;
+		}
+		if (0 != mask) {
+			xcb_configure_window(g_conn, c->window, mask, values);
+		}
+		if (c->sent.border_color != c->want.border_color) {
+			xcb_change_window_attributes(g_conn, c->window,
+			    XCB_CW_BORDER_PIXEL, &c->want.border_color);
+		}
+		c->sent = c->want;
+	}
+	if (1 < num) {
+		xcb_ungrab_server(g_conn);
+	}
+	g_txn_raise = XCB_NONE;
+}
+
+void
+txn_touch(struct Client *a_client)
+{
+	if (a_client->is_pending) {
+		return;
 	}
-	return c_text_padding + width + c_text_padding;
+	if (g_txn_cap == g_txn_num) {
+		g_txn_cap = MAX(16, 2 * g_txn_cap);
+		REALLOC(g_txn_window, g_txn_cap);
+	}
+	g_txn_window[g_txn_num++] = a_client->window;
+	a_client->is_pending = 1;
 }
 
 void
@@ -1628,8 +4520,24 @@ view_clear()
 
 		view = TAILQ_FIRST(&g_view_list);
 		TAILQ_REMOVE(&g_view_list, view, next);
-		FREE(view);
+		view_free(view);
+	}
+}
+
+/* Covers the whole screen when RandR has nothing to offer at startup. */
+void
+view_fallback()
+{
+	struct View *view;
+
+	if (!TAILQ_EMPTY(&g_view_list)) {
+		return;
 	}
+	CALLOC(view, 1);
+	view->width = g_screen->width_in_pixels;
+	view->height = g_screen->height_in_pixels;
+	bar_reset(view);
+	TAILQ_INSERT_TAIL(&g_view_list, view, next);
 }
 
 struct View const *
@@ -1646,23 +4554,110 @@ view_find(int a_x, int a_y)
 	return TAILQ_FIRST(&g_view_list);
 }
 
+struct View *
+view_find_bar(xcb_window_t a_window)
+{
+	struct View *view;
+
+	TAILQ_FOREACH(view, &g_view_list, next) {
+		if (a_window == view->bar) {
+			return view;
+		}
+	}
+	return NULL;
+}
+
+void
+view_free(struct View *a_view)
+{
+	if (XCB_NONE != a_view->bar) {
+		xcb_destroy_window(g_conn, a_view->bar);
+		xcb_free_pixmap(g_conn, a_view->pixmap);
+	}
+	free(a_view->segment);
+	free(a_view->segment_next);
+	free(a_view);
+}
+
+xcb_visualtype_t const *
+visual_get()
+{
+	xcb_depth_iterator_t depth_it;
+
+	for (depth_it = xcb_screen_allowed_depths_iterator(g_screen);
+	    depth_it.rem; xcb_depth_next(&depth_it)) {
+		xcb_visualtype_iterator_t it;
+
+		for (it = xcb_depth_visuals_iterator(depth_it.data); it.rem;
+		    xcb_visualtype_next(&it)) {
+			if (g_screen->root_visual == it.data->visual_id) {
+				return it.data;
+			}
+		}
+	}
+	return NULL;
+}
+
 int
-main(void)
+main(int argc, char **argv)
 {
 	xcb_font_t cursor_font;
 	xcb_screen_iterator_t it;
-	struct pollfd fds;
-	FILE *file;
+	struct pollfd fds[2];
 	xcb_query_extension_reply_t const *ext_reply;
-	xcb_query_font_reply_t *font_reply;
 	xcb_query_tree_reply_t *tree_reply;
-	struct KeyBind const *bind;
+	char const *c_atom_name[] = {"WM_DELETE_WINDOW", "WM_PROTOCOLS",
+		"_NET_WM_NAME", "_NET_ACTIVE_WINDOW", "_NET_CLIENT_LIST",
+		"_NET_CURRENT_DESKTOP", "_NET_NUMBER_OF_DESKTOPS",
+		"_NET_SUPPORTED", "_NET_WM_DESKTOP"};
+	xcb_atom_t *const c_atom[] = {&g_WM_DELETE_WINDOW, &g_WM_PROTOCOLS,
+		&g_NET_WM_NAME, &g_NET_ACTIVE_WINDOW, &g_NET_CLIENT_LIST,
+		&g_NET_CURRENT_DESKTOP, &g_NET_NUMBER_OF_DESKTOPS,
+		&g_NET_SUPPORTED, &g_NET_WM_DESKTOP};
+	xcb_intern_atom_cookie_t atom_cookie[LENGTH(c_atom_name)];
+	struct ColorRequest color[] = {
+		{c_border_focus, &g_color_border_focus},
+		{c_border_unfocus, &g_color_border_unfocus},
+		{c_bar_bg, &g_color_bar_bg},
+		{c_bar_fg, &g_color_bar_fg},
+		{c_urgent1_bg, &g_color_urgent1_bg},
+		{c_urgent1_fg, &g_color_urgent1_fg},
+		{c_urgent2_bg, &g_color_urgent2_bg},
+		{c_urgent2_fg, &g_color_urgent2_fg}
+	};
+	xcb_query_font_cookie_t font_cookie;
+	xcb_query_tree_cookie_t tree_cookie;
+	struct RandrCookie randr_cookie;
+	xcb_get_modifier_mapping_cookie_t modifier_cookie;
+	char const *trace_path = NULL;
+	double t0;
 	size_t i;
-	int screen_no, error;
+	int screen_no, error, is_replay = 0, restore_fd = -1;
+
+	t0 = time_get();
+
+	for (i = 1; (size_t)argc > i; ++i) {
+		if (0 == strcmp(argv[i], "--audit")) {
+			g_audit_is_strict = 1;
+		} else if ((size_t)argc > i + 1 && (0 == strcmp(argv[i],
+		    "--record") || (is_replay = 0 == strcmp(argv[i],
+		    "--replay")))) {
+			trace_path = argv[++i];
+		} else if ((size_t)argc > i + 1 && 0 == strcmp(argv[i],
+		    "--restore")) {
+			restore_fd = strtol(argv[++i], NULL, 10);
+		} else {
+			fprintf(stderr, "Usage: %s [--audit] "
+			    "[--record|--replay trace] [--restore fd]\n",
+			    argv[0]);
+			exit(EXIT_FAILURE);
+		}
+	}
 
 	atexit(my_exit);
 
 	CALLOC(g_client_list, LENGTH(c_workspace_label));
+	CALLOC(g_edge_index, LENGTH(c_workspace_label));
 	for (i = 0; LENGTH(c_workspace_label) > i; ++i) {
 		TAILQ_INIT(&g_client_list[i]);
 	}
@@ -1670,13 +4665,12 @@ main(void)
 	if (SIG_ERR == signal(SIGCHLD, SIG_IGN)) {
 		err(EXIT_FAILURE, "SIGCHLD=SIG_IGN failed");
 	}
-	if ((iconv_t)-1 == (g_iconv = iconv_open("UCS-2BE", "UTF-8"))) {
-		err(EXIT_FAILURE, "Could not open iconv(UCS-2BE, UTF-8).");
+	if (SIG_ERR == signal(SIGUSR1, stats_signal)) {
+		err(EXIT_FAILURE, "SIGUSR1=stats_signal failed");
 	}
-	CALLOC(g_workspace_label, LENGTH(c_workspace_label));
-	for (i = 0; LENGTH(c_workspace_label) > i; ++i) {
-		string_convert(&g_workspace_label[i], c_workspace_label[i],
-		    strlen(c_workspace_label[i]));
+	if (-1 == (g_timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC |
+	    TFD_NONBLOCK))) {
+		err(EXIT_FAILURE, "timerfd_create");
 	}
 
 	/* XCB basics. */
@@ -1693,6 +4687,26 @@ main(void)
 		errx(EXIT_FAILURE, "Could not get screen %d.", screen_no);
 	}
 	g_root = g_screen->root;
+	g_visual = visual_get();
+
+	/*
+	 * Independent requests go out together and the replies are collected
+	 * when needed, so startup waits for a handful of round trips.
+	 */
+	xcb_prefetch_extension_data(g_conn, &xcb_randr_id);
+	/* hwm owns the EWMH atoms, they may not exist on a fresh server. */
+	for (i = 0; LENGTH(c_atom_name) > i; ++i) {
+		atom_cookie[i] = xcb_intern_atom(g_conn, 0,
+		    strlen(c_atom_name[i]), c_atom_name[i]);
+	}
+	g_font = xcb_generate_id(g_conn);
+	xcb_open_font(g_conn, g_font, sizeof(c_font_face) - 1, c_font_face);
+	font_cookie = xcb_query_font(g_conn, g_font);
+	for (i = 0; LENGTH(color) > i; ++i) {
+		color_request(&color[i]);
+	}
+	g_key_symbols = xcb_key_symbols_alloc(g_conn);
+	modifier_cookie = xcb_get_modifier_mapping(g_conn);
 
 	/* RANDR. */
 	ext_reply = xcb_get_extension_data(g_conn, &xcb_randr_id);
@@ -1705,6 +4719,12 @@ main(void)
 	    XCB_RANDR_NOTIFY_MASK_CRTC_CHANGE |
 	    XCB_RANDR_NOTIFY_MASK_OUTPUT_CHANGE |
 	    XCB_RANDR_NOTIFY_MASK_OUTPUT_PROPERTY);
+	randr_request(&randr_cookie);
+
+	/* Tracing, everything from here on must be replayable. */
+	if (trace_path) {
+		trace_open(trace_path, is_replay);
+	}
 
 	/* Event handlers. */
 #define EVENT_SET(type, func) g_event_handler[type] = (EventHandler)func
@@ -1714,10 +4734,12 @@ main(void)
 	EVENT_SET(XCB_EXPOSE, event_expose);
 	EVENT_SET(XCB_DESTROY_NOTIFY, event_destroy_notify);
 	EVENT_SET(XCB_UNMAP_NOTIFY, event_unmap_notify);
+	EVENT_SET(XCB_MAP_NOTIFY, event_map_notify);
 	EVENT_SET(XCB_MAP_REQUEST, event_map_request);
 	EVENT_SET(XCB_CONFIGURE_NOTIFY, event_configure_notify);
 	EVENT_SET(XCB_CONFIGURE_REQUEST, event_configure_request);
 	EVENT_SET(XCB_PROPERTY_NOTIFY, event_property_notify);
+	EVENT_SET(XCB_MAPPING_NOTIFY, event_mapping_notify);
 
 	/* Pointer cursors. */
 	cursor_font = xcb_generate_id(g_conn);
@@ -1736,147 +4758,182 @@ main(void)
 	    xcb_change_window_attributes_checked, (g_conn, g_root,
 	    XCB_CW_EVENT_MASK | XCB_CW_CURSOR, g_values));
 
-	g_key_symbols = xcb_key_symbols_alloc(g_conn);
+	/* Only now that we redirect will the tree stay complete. */
+	tree_cookie = xcb_query_tree(g_conn, g_root);
 
 	/* Atoms. */
-	g_WM_DELETE_WINDOW = atom_get("WM_DELETE_WINDOW");
-	g_WM_PROTOCOLS = atom_get("WM_PROTOCOLS");
-	g_NET_WM_NAME = atom_get("_NET_WM_NAME");
+	for (i = 0; LENGTH(c_atom_name) > i; ++i) {
+		xcb_intern_atom_reply_t *reply;
+
+		if (!(reply = REPLY(xcb_intern_atom_reply(g_conn,
+		    atom_cookie[i], NULL)))) {
+			errx(EXIT_FAILURE, "Could not get atom '%s'.",
+			    c_atom_name[i]);
+		}
+		*c_atom[i] = reply->atom;
+		free(reply);
+	}
+	{
+		uint32_t const c_desktop_num = LENGTH(c_workspace_label);
+		xcb_atom_t supported[LENGTH(c_atom) - 2];
+
+		/* Everything after the ICCCM atoms. */
+		for (i = 0; LENGTH(supported) > i; ++i) {
+			supported[i] = *c_atom[i + 2];
+		}
+		xcb_change_property(g_conn, XCB_PROP_MODE_REPLACE, g_root,
+		    g_NET_SUPPORTED, XCB_ATOM_ATOM, 32, LENGTH(supported),
+		    supported);
+		xcb_change_property(g_conn, XCB_PROP_MODE_REPLACE, g_root,
+		    g_NET_NUMBER_OF_DESKTOPS, XCB_ATOM_CARDINAL, 32, 1,
+		    &c_desktop_num);
+	}
 
 	/* Graphics. */
-	g_font = xcb_generate_id(g_conn);
-	xcb_open_font(g_conn, g_font, sizeof(c_font_face) - 1, c_font_face);
-	if (!(font_reply = xcb_query_font_reply(g_conn, xcb_query_font(g_conn,
-	    g_font), NULL))) {
+	if (!(g_font_info = REPLY(xcb_query_font_reply(g_conn, font_cookie,
+	    NULL)))) {
 		errx(EXIT_FAILURE, "Could not load font face '%s'.",
 		    c_font_face);
 	}
-	g_font_ascent = font_reply->font_ascent;
-	g_font_height = g_font_ascent + font_reply->font_descent;
-	free(font_reply);
-
-	g_gc = xcb_generate_id(g_conn);
-	xcb_create_gc(g_conn, g_gc, g_root, 0, NULL);
-	xcb_change_gc(g_conn, g_gc, XCB_GC_FONT, &g_font);
+	g_font_ascent = g_font_info->font_ascent;
+	g_font_height = g_font_ascent + g_font_info->font_descent;
+	CALLOC(g_workspace_label, LENGTH(c_workspace_label));
+	for (i = 0; LENGTH(c_workspace_label) > i; ++i) {
+		string_convert(&g_workspace_label[i], c_workspace_label[i],
+		    strlen(c_workspace_label[i]));
+	}
 
 	/* Configs. */
-	g_color_border_focus = color_get(c_border_focus);
-	g_color_border_unfocus = color_get(c_border_unfocus);
-	g_color_bar_bg = color_get(c_bar_bg);
-	g_color_bar_fg = color_get(c_bar_fg);
-	g_color_urgent1_bg = color_get(c_urgent1_bg);
-	g_color_urgent1_fg = color_get(c_urgent1_fg);
-	g_color_urgent2_bg = color_get(c_urgent2_bg);
-	g_color_urgent2_fg = color_get(c_urgent2_fg);
+	for (i = 0; LENGTH(color) > i; ++i) {
+		color_reply(&color[i]);
+	}
 
-	for (i = 0, bind = c_key_bind; LENGTH(c_key_bind) > i; ++i, ++bind) {
-		xcb_keycode_t *keycode_list;
+	/* One GC pair per bar scheme, nothing is changed when drawing. */
+	for (i = 0; SCHEME_NUM > i; ++i) {
+		uint32_t values[4];
 
-		keycode_list = xcb_key_symbols_get_keycode(g_key_symbols,
-		    bind->keysym);
-		xcb_grab_key(g_conn, 1, g_root, bind->state, *keycode_list,
-		    XCB_GRAB_MODE_ASYNC, XCB_GRAB_MODE_ASYNC);
-		free(keycode_list);
+		switch (i) {
+		case SCHEME_NORMAL:
+			values[0] = g_color_bar_fg;
+			values[1] = g_color_bar_bg;
+			break;
+		case SCHEME_FOCUS:
+			values[0] = g_color_bar_bg;
+			values[1] = g_color_bar_fg;
+			break;
+		case SCHEME_URGENT1:
+			values[0] = g_color_urgent1_fg;
+			values[1] = g_color_urgent1_bg;
+			break;
+		case SCHEME_URGENT2:
+			values[0] = g_color_urgent2_fg;
+			values[1] = g_color_urgent2_bg;
+			break;
+		}
+		values[2] = g_font;
+		values[3] = 0;
+		g_gc_text[i] = xcb_generate_id(g_conn);
+		xcb_create_gc(g_conn, g_gc_text[i], g_root, XCB_GC_FOREGROUND |
+		    XCB_GC_BACKGROUND | XCB_GC_FONT |
+		    XCB_GC_GRAPHICS_EXPOSURES, values);
+		values[0] = values[1];
+		values[1] = 0;
+		g_gc_fill[i] = xcb_generate_id(g_conn);
+		xcb_create_gc(g_conn, g_gc_fill[i], g_root, XCB_GC_FOREGROUND |
+		    XCB_GC_GRAPHICS_EXPOSURES, values);
 	}
 
-	randr_update();
+	key_grab(modifier_cookie);
+
+	randr_update(&randr_cookie);
 
 	/* Furnish existing windows, and reuse persist info. */
-	if ((tree_reply = xcb_query_tree_reply(g_conn, xcb_query_tree(g_conn,
-	    g_root), NULL))) {
-		char line[80], *p;
-		struct Client *c;
-		int j[11];
+	if ((tree_reply = REPLY(xcb_query_tree_reply(g_conn, tree_cookie,
+	    NULL)))) {
+		struct Adopt *adopt;
 		xcb_window_t *w;
-		size_t num;
+		xcb_window_t focus_id = XCB_NONE;
+		size_t adopt_num, num;
 
-		(void)c;
 		w = xcb_query_tree_children(tree_reply);
 		num = xcb_query_tree_children_length(tree_reply);
-		if ((file = fopen(c_persist_file, "rb"))) {
-			xcb_window_t focus_id;
-
-			fgets(line, sizeof line, file);
-			g_workspace_cur = strtol(line, NULL, 10);
-			g_workspace_cur = MIN(LENGTH(c_workspace_label),
-			    g_workspace_cur);
-			fgets(line, sizeof line, file);
-			focus_id = strtol(line, NULL, 10);
-			while (fgets(line, sizeof line, file)) {
-				for (p = strtok(line, " "), i = 0; p && 11 >
-				    i; p = strtok(NULL, " "), ++i) {
-					j[i] = strtol(p, NULL, 10);
-				}
-				if (11 == i) {
-					for (i = 0; num > i; ++i) {
-						if (j[0] == (int)w[i]) {
-							c = client_add_details
-							    (w[i],
-							     XCB_WINDOW_NONE,
-							     j + 1);
-							w[i] = XCB_NONE;
-							break;
-						}
-					}
-				}
-			}
-			if (XCB_NONE != focus_id) {
-				g_focus = client_get(focus_id, NULL);
-				client_focus(g_focus, 1, 1, 0);
-			}
-			fclose(file);
+		CALLOC(adopt, num + 1);
+		adopt_num = 0;
+		if (-1 == restore_fd && !g_trace_is_replay) {
+			restore_fd = open(c_persist_file, O_RDONLY);
+		}
+		if (-1 != restore_fd) {
+			adopt_num = persist_load(restore_fd, adopt, w, num,
+			    &focus_id);
+			close(restore_fd);
 		}
 		for (i = 0; num > i; ++i) {
 			if (XCB_NONE != w[i]) {
-				c = client_add(w[i], XCB_WINDOW_NONE);
+				adopt[adopt_num].window = w[i];
+				adopt[adopt_num].data[0] = -1;
+				++adopt_num;
 			}
 		}
+		for (i = 0; adopt_num > i; ++i) {
+			adopt[i].parent = XCB_WINDOW_NONE;
+		}
+		client_adopt(adopt, adopt_num);
+		free(adopt);
+		if (XCB_NONE != focus_id) {
+			g_focus = client_get(focus_id, NULL);
+			client_focus(g_focus, 1, 1, 0);
+		}
 		free(tree_reply);
 	}
 
 	/* Bar. */
+	CALLOC(g_status, LENGTH(c_status_bind));
+	status_update();
 	root_name_update();
 	bar_draw();
 
+	ewmh_flush();
+	txn_commit();
 	xcb_flush(g_conn);
+	g_stat_startup = time_get() - t0;
 
 	/* Main loop. */
-	fds.fd = xcb_get_file_descriptor(g_conn);
-	fds.events = POLLIN;
+	fds[0].fd = xcb_get_file_descriptor(g_conn);
+	fds[0].events = POLLIN;
+	fds[1].fd = g_timer_fd;
+	fds[1].events = POLLIN;
 	g_has_urgent = 0;
-	g_timeout = c_timeout_normal;
 	for (g_run = RUN_LOOP; RUN_LOOP == g_run;) {
-		xcb_generic_event_t *ev;
-
-		poll(&fds, 1, g_timeout);
+		poll(fds, LENGTH(fds), g_trace_is_replay ? 0 : -1);
 		g_do_bar_redraw = 0;
-		while ((ev = xcb_poll_for_event(g_conn))) {
-			event_handle(ev);
-			xcb_flush(g_conn);
-			free(ev);
-		}
-		if (g_has_urgent) {
-			struct timeval tv;
-			double dt, time_cur;
-
-			gettimeofday(&tv, NULL);
-			time_cur = 1e3 * tv.tv_sec + 1e-3 * tv.tv_usec;
-			dt = time_cur - g_time_prev;
-			g_time_prev = time_cur;
-			g_timeout = MIN(g_timeout - dt, c_timeout_blink);
-			if (0 >= g_timeout) {
-				g_timeout = c_timeout_blink;
-				g_blink ^= 1;
-				g_do_bar_redraw = 1;
-			}
-		} else {
-			g_timeout = c_timeout_normal;
-			g_blink = 0;
+		if (POLLIN & fds[1].revents) {
+			timer_run();
 		}
+		event_batch();
+		if (g_has_name_dirty) {
+			client_name_flush();
+		}
+		if (g_do_stats) {
+			g_do_stats = 0;
+			stats_print();
+		}
+		txn_commit();
 		if (g_do_bar_redraw) {
 			bar_draw();
-			xcb_flush(g_conn);
 		}
+		xcb_flush(g_conn);
+		/* Only blink while something is urgent, else sleep. */
+		if (g_has_urgent && g_timer_num == timer_find(bar_blink)) {
+			timer_add(c_timeout_blink, bar_blink);
+		} else if (!g_has_urgent) {
+			timer_remove(bar_blink);
+			g_blink = 0;
+		}
+	}
+
+	/* Replays must not touch the persist info of the real session. */
+	if (g_trace_is_replay) {
+		trace_done();
 	}
 
 	/* Save persist info. */
@@ -1885,26 +4942,8 @@ main(void)
 		exit(0);
 	}
 
-	if (!(file = fopen(c_persist_file, "wb"))) {
-		warn("Could not save persist info");
-	} else {
-		fprintf(file, "%d\n", (int)g_workspace_cur);
-		fprintf(file, "%u\n", g_focus ? g_focus->window :
-		    (xcb_window_t)XCB_NONE);
-		for (i = 0; LENGTH(c_workspace_label) > i; ++i) {
-			struct Client *c;
-
-			TAILQ_FOREACH(c, &g_client_list[i], next) {
-				fprintf(file, "%u %d %d %d %d %d %d %d %d "
-				    "%d %d\n", c->window, (int)i,
-				    c->is_urgent, c->x, c->y, c->maximize,
-				    c->border_width, c->max_old_x,
-				    c->max_old_y, c->max_old_width,
-				    c->max_old_height);
-			}
-		}
-		fclose(file);
-	}
-
+	/* Leave it to a shell loop if we cannot exec. */
+	restart(argv);
+	persist_save();
 	exit(2);
 }